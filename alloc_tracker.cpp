@@ -0,0 +1,244 @@
+#include "alloc_tracker.h"
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <mutex>
+#include <new>
+
+// Call stacks need glibc, other GCC builds only get the direct caller
+#ifndef NDEBUG
+	#if defined(__GLIBC__)
+		#include <execinfo.h>
+		#define ALLOC_BACKTRACE
+		#define ALLOC_CAPTURE
+	#elif defined(__GNUC__)
+		#define ALLOC_CAPTURE
+	#endif
+#endif
+#ifdef __GNUC__
+	#define ALLOC_CALLER __builtin_return_address(0)
+	#define ALLOC_NOINLINE __attribute__((noinline))
+#else
+	#define ALLOC_CALLER nullptr
+	#define ALLOC_NOINLINE
+#endif
+
+// Plain old data, so the counters need no constructor before the first allocation
+static thread_local alloc_stats totalStats;
+static thread_local alloc_stats frameStart;
+
+#ifdef ALLOC_CAPTURE
+struct alloc_site{
+	void *frames[ALLOC_TRACKER_DEPTH];
+	int depth;
+	unsigned long long allocations, bytes;
+};
+
+static std::mutex sitesLock;
+static alloc_site sites[ALLOC_TRACKER_SITES];
+static int siteCount = 0;
+static unsigned long long unrecorded = 0;		// allocations after the table was full
+static thread_local bool capturing = false;
+static thread_local bool inCapture = false;		// backtrace() may allocate itself
+
+static void captureSite(size_t size, void *caller)
+{
+	alloc_site site;
+#ifdef ALLOC_BACKTRACE
+	(void)caller;
+	// Skip countAllocation and operator new
+	void *frames[ALLOC_TRACKER_DEPTH+2];
+	int depth = backtrace(frames, ALLOC_TRACKER_DEPTH+2)-2;
+	site.depth = std::max(depth, 0);
+	std::copy(frames+2, frames+2+site.depth, site.frames);
+#else
+	site.frames[0] = caller;
+	site.depth = 1;
+#endif
+
+	std::lock_guard<std::mutex> guard(sitesLock);
+	for (int i=0;i<siteCount;i++) {
+		if (sites[i].depth == site.depth && std::equal(site.frames, site.frames+site.depth, sites[i].frames)) {
+			sites[i].allocations++;
+			sites[i].bytes += size;
+			return;
+		}
+	}
+	if (siteCount == ALLOC_TRACKER_SITES) {
+		unrecorded++;
+		return;
+	}
+	site.allocations = 1;
+	site.bytes = size;
+	sites[siteCount++] = site;
+}
+#endif
+
+static ALLOC_NOINLINE void countAllocation(size_t size, void *caller)
+{
+	totalStats.allocations++;
+	totalStats.bytes += size;
+#ifdef ALLOC_CAPTURE
+	if (capturing && !inCapture) {
+		inCapture = true;
+		captureSite(size, caller);
+		inCapture = false;
+	}
+#endif
+}
+
+static void *allocate(size_t size)
+{
+	if (size == 0)
+		size = 1;
+	while (true) {
+		void *p = malloc(size);
+		if (p)
+			return p;
+		std::new_handler handler = std::get_new_handler();
+		if (handler == nullptr)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+
+static void deallocate(void *p)
+{
+	if (p == nullptr)
+		return;
+	totalStats.frees++;
+	free(p);
+}
+
+void *operator new(size_t size)
+{
+	countAllocation(size, ALLOC_CALLER);
+	return allocate(size);
+}
+
+void *operator new[](size_t size)
+{
+	countAllocation(size, ALLOC_CALLER);
+	return allocate(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	countAllocation(size, ALLOC_CALLER);
+	try {
+		return allocate(size);
+	}
+	catch (...) {
+		return nullptr;
+	}
+}
+
+void *operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	countAllocation(size, ALLOC_CALLER);
+	try {
+		return allocate(size);
+	}
+	catch (...) {
+		return nullptr;
+	}
+}
+
+void operator delete(void *p) noexcept
+{
+	deallocate(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	deallocate(p);
+}
+
+void operator delete(void *p, const std::nothrow_t&) noexcept
+{
+	deallocate(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t&) noexcept
+{
+	deallocate(p);
+}
+
+alloc_stats AllocTracker::total()
+{
+	return totalStats;
+}
+
+void AllocTracker::beginFrame()
+{
+	frameStart = totalStats;
+}
+
+alloc_stats AllocTracker::frame()
+{
+	alloc_stats stats;
+	stats.allocations = totalStats.allocations-frameStart.allocations;
+	stats.frees = totalStats.frees-frameStart.frees;
+	stats.bytes = totalStats.bytes-frameStart.bytes;
+	return stats;
+}
+
+bool AllocTracker::captureSupported()
+{
+#ifdef ALLOC_CAPTURE
+	return true;
+#else
+	return false;
+#endif
+}
+
+void AllocTracker::setCapture(bool capture)
+{
+#ifdef ALLOC_BACKTRACE
+	// The first backtrace() loads the unwinder, don't let that be the first capture
+	if (capture) {
+		void *frames[1];
+		backtrace(frames, 1);
+	}
+#endif
+#ifdef ALLOC_CAPTURE
+	capturing = capture;
+#endif
+}
+
+void AllocTracker::printSites()
+{
+#ifdef ALLOC_CAPTURE
+	std::lock_guard<std::mutex> guard(sitesLock);
+	int order[ALLOC_TRACKER_SITES];
+	for (int i=0;i<siteCount;i++)
+		order[i] = i;
+	std::sort(order, order+siteCount, [](int a, int b) { return sites[a].allocations > sites[b].allocations; });
+	for (int i=0;i<siteCount;i++) {
+		const alloc_site &site = sites[order[i]];
+		printf("%llu allocations, %llu bytes from:\n", site.allocations, site.bytes);
+	#ifdef ALLOC_BACKTRACE
+		// Addresses of the executable resolve with addr2line -e, or link with -rdynamic
+		fflush(stdout);
+		backtrace_symbols_fd(site.frames, site.depth, fileno(stdout));
+	#else
+		printf("  %p\n", site.frames[0]);
+	#endif
+	}
+	if (unrecorded > 0)
+		printf("%llu allocations from other call sites\n", unrecorded);
+	siteCount = 0;
+	unrecorded = 0;
+#else
+	printf("Allocation call sites are not captured in this build\n");
+#endif
+}
+
+void AllocTracker::clearSites()
+{
+#ifdef ALLOC_CAPTURE
+	std::lock_guard<std::mutex> guard(sitesLock);
+	siteCount = 0;
+	unrecorded = 0;
+#endif
+}
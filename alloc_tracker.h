@@ -0,0 +1,39 @@
+#ifndef ALLOC_TRACKER_H
+#define ALLOC_TRACKER_H
+
+#include <cstddef>
+
+#define ALLOC_TRACKER_SITES 64		// call sites remembered, later new ones are only counted
+#define ALLOC_TRACKER_DEPTH 6		// return addresses kept per call site
+
+struct alloc_stats{
+	unsigned long long allocations;
+	unsigned long long frees;
+	unsigned long long bytes;		// requested by the allocations
+};
+
+// Counts heap allocations made through operator new and delete, which are replaced
+// in alloc_tracker.cpp for the whole program. Counters are per thread, so a frame
+// only sees what the thread calling it allocated; malloc called directly (the GL
+// driver, stdio) is not counted.
+// In builds without NDEBUG the call stack of every allocation can be captured while
+// it is turned on, and printed grouped by call site.
+class AllocTracker{
+public:
+	// Counters of the calling thread since the program started
+	static alloc_stats total();
+	// Start counting a new frame on the calling thread
+	static void beginFrame();
+	// Counters of the calling thread since beginFrame()
+	static alloc_stats frame();
+
+	// Remember where the allocations of the calling thread come from, until turned off.
+	// Does nothing with NDEBUG defined
+	static void setCapture(bool capture);
+	static bool captureSupported();
+	// Call sites seen while capturing, most allocations first, then forget them
+	static void printSites();
+	static void clearSites();
+};
+
+#endif // ALLOC_TRACKER_H
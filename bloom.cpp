@@ -0,0 +1,129 @@
+#include "bloom.h"
+#include "gl_state.h"
+#include <algorithm>
+#include <cstring>
+
+Bloom::Bloom(): paramsBuffer(0), dirtTexture(0), dirty(true)
+{
+	memset(&params, 0, sizeof(params));
+	setThreshold(1.0f, 0.5f);
+	setIntensity(0.3f, 0.0f);
+	setRadius(1.0f);
+}
+
+void Bloom::init()
+{
+	glGenBuffers(1, &paramsBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, paramsBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(params), nullptr, GL_DYNAMIC_DRAW);
+	dirty = true;
+}
+
+void Bloom::release()
+{
+	glDeleteBuffers(1, &paramsBuffer);
+	paramsBuffer = 0;
+	if (dirtTexture) {
+		glDeleteTextures(1, &dirtTexture);
+		glState.deletedTexture(dirtTexture);
+	}
+	dirtTexture = 0;
+}
+
+void Bloom::bindProgram(unsigned int program)
+{
+	GLuint index = glGetUniformBlockIndex(program, "BloomParams");
+	if (index == GL_INVALID_INDEX)
+		return;
+	glUniformBlockBinding(program, index, BLOOM_BLOCK_BINDING);
+	// Units never change, so they are set here instead of every frame
+	glState.useProgram(program);
+	const char *samplers[] = {"uSampler", "bloomSampler", "dirtSampler"};
+	for (int i=0;i<3;i++) {
+		GLint location = glGetUniformLocation(program, samplers[i]);
+		if (location >= 0)
+			glUniform1i(location, i);
+	}
+}
+
+int Bloom::levels(int width, int height)
+{
+	int levels = 0;
+	while (levels < BLOOM_MAX_LEVELS && std::min(width, height) >> (levels+1) >= BLOOM_MIN_SIZE)
+		levels++;
+	return levels;
+}
+
+void Bloom::setThreshold(float threshold, float knee)
+{
+	knee = std::max(knee, 1e-4f);
+	params.curve[0] = threshold;
+	params.curve[1] = threshold-knee;
+	params.curve[2] = 2.0f*knee;
+	params.curve[3] = 0.25f/knee;
+	dirty = true;
+}
+
+void Bloom::setIntensity(float intensity, float dirtIntensity)
+{
+	params.intensity = intensity;
+	params.dirtIntensity = dirtIntensity;
+	dirty = true;
+}
+
+void Bloom::setRadius(float radius)
+{
+	params.radius = radius;
+	dirty = true;
+}
+
+void Bloom::setDirt(unsigned int width, unsigned int height, unsigned short int bits, const unsigned char *bgr)
+{
+	if (dirtTexture == 0)
+		glGenTextures(1, &dirtTexture);
+	glState.editTexture(dirtTexture);
+	// Rows of 24 bit bmps are padded to 4 bytes, which is the default unpack alignment
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, bits == 32 ? GL_BGRA : GL_BGR, GL_UNSIGNED_BYTE, bgr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glState.bindTexture(0, 0);
+}
+
+void Bloom::bind(GLuint program, GLuint vao)
+{
+	if (dirty) {
+		glBindBuffer(GL_UNIFORM_BUFFER, paramsBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(params), &params);
+		dirty = false;
+	}
+	glBindBufferBase(GL_UNIFORM_BUFFER, BLOOM_BLOCK_BINDING, paramsBuffer);
+	glState.bindVertexArray(vao);
+	glState.setDepthTest(false);
+	glState.useProgram(program);
+}
+
+void Bloom::downsample(GLuint program, GLuint vao, GLuint source)
+{
+	bind(program, vao);
+	glState.bindTexture(0, source);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+void Bloom::upsample(GLuint program, GLuint vao, GLuint lower, GLuint level)
+{
+	bind(program, vao);
+	glState.bindTexture(0, lower);
+	glState.bindTexture(1, level);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+void Bloom::composite(GLuint program, GLuint vao, GLuint scene, GLuint bloom)
+{
+	bind(program, vao);
+	glState.bindTexture(0, scene);
+	glState.bindTexture(1, bloom);
+	glState.bindTexture(2, dirtTexture);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+}
@@ -0,0 +1,65 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <GL/glew.h>
+
+#define BLOOM_BLOCK_BINDING 3		// next to the kernel of gaussian_blur.h
+#define BLOOM_MAX_LEVELS 6			// the smallest level is 1/64 of the scene on each side
+#define BLOOM_MIN_SIZE 8			// no level is smaller than this on either side
+
+// std140 layout of "BloomParams" in the bloom shaders
+struct bloom_params_block{
+	GLfloat curve[4];			// threshold, threshold-knee, 2*knee, 0.25/knee
+	GLfloat intensity;			// of the bloom added to the scene
+	GLfloat radius;				// of the tent filter going up, in texels of the smaller level
+	GLfloat dirtIntensity;		// extra intensity where the dirt texture is opaque
+	GLfloat pad;
+};
+
+// Glow around the parts of an HDR scene brighter than a threshold.
+// A chain of levels, each half the size of the one before, is made by a 13-tap
+// downsample, the first step keeping only what is above the threshold (with a soft
+// knee). Going back up, every level adds a 3x3 tent of the level below to its own.
+// The glow spreads over the whole chain, so a wider glow means a larger tent radius,
+// not more taps; every level costs a quarter of the one before it.
+// The result is added to the scene, where the alpha of an optional dirt texture
+// stretched over the screen makes it stronger.
+// The passes draw into targets the caller binds, see the bloom passes in main.cpp.
+class Bloom{
+public:
+	Bloom();
+
+	// Must be called with a current GL context
+	void init();
+	void release();
+
+	// Connect the params block and samplers of `program`, once after linking
+	static void bindProgram(unsigned int program);
+	// Levels of the chain for a scene of this size
+	static int levels(int width, int height);
+
+	void setThreshold(float threshold, float knee);
+	void setIntensity(float intensity, float dirtIntensity);
+	void setRadius(float radius);
+	// Pixels of a bmp (24 or 32 bits, bottom-up rows), only the alpha is used
+	void setDirt(unsigned int width, unsigned int height, unsigned short int bits, const unsigned char *bgr);
+
+	// One step into the bound framebuffer, the viewport must cover it.
+	// Down from the scene or the level above, with the prefilter or down permutation
+	void downsample(GLuint program, GLuint vao, GLuint source);
+	// Up from the level below, adding the down chain of the target's level
+	void upsample(GLuint program, GLuint vao, GLuint lower, GLuint level);
+	// The scene with the first level of the up chain added, over the viewport only:
+	// it reads the scene at the pixel it writes, so any part of the scene can be drawn
+	void composite(GLuint program, GLuint vao, GLuint scene, GLuint bloom);
+
+private:
+	void bind(GLuint program, GLuint vao);
+
+	GLuint paramsBuffer;
+	GLuint dirtTexture;
+	bloom_params_block params;
+	bool dirty;				// params changed since the last upload
+};
+
+#endif // BLOOM_H
@@ -1,3 +1,3 @@
 gcc -DGLEW_STATIC -I. -c glew.c
-g++ -o HW4 -static -O2 -std=c++0x -DGLEW_STATIC main.cpp tiny_obj_loader.cc glew.o -I.  -lglfw3 -lopengl32 -lgdi32
+g++ -o HW4 -static -O2 -std=c++0x -DGLEW_STATIC main.cpp alloc_tracker.cpp bloom.cpp cpu_profiler.cpp frame_benchmark.cpp frame_capture.cpp gaussian_blur.cpp geometry_buffer.cpp gl_state.cpp gpu_profiler.cpp headless_context.cpp hud.cpp instance_buffer.cpp object_store.cpp program_cache.cpp render_graph.cpp render_queue.cpp scene_graph.cpp shader_compiler.cpp stream_buffer.cpp texture_manager.cpp tiny_obj_loader.cc transform_stage.cpp uniform_blocks.cpp uniform_table.cpp glew.o -I.  -lglfw3 -lopengl32 -lgdi32
 strip HW4.exe
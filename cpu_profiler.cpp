@@ -0,0 +1,129 @@
+#include "cpu_profiler.h"
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+struct cpu_event{
+	const char *name;
+	int64_t start, end;
+};
+
+// Ring of one thread
+struct thread_events{
+	std::vector<cpu_event> events;
+	size_t next;
+	bool wrapped;
+	int id;
+};
+
+static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+static std::mutex threadsLock;
+static std::vector<thread_events*> threads;		// never freed, a thread's events outlive it
+static thread_local thread_events *local = nullptr;
+static int64_t frameStarts[CPU_PROFILER_FRAMES];
+static unsigned int frameCount = 0;
+
+int64_t CpuProfiler::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-epoch).count();
+}
+
+void CpuProfiler::record(const char *name, int64_t start, int64_t end)
+{
+	if (local == nullptr) {
+		local = new thread_events;
+		local->events.resize(CPU_PROFILER_EVENTS);
+		local->next = 0;
+		local->wrapped = false;
+		std::lock_guard<std::mutex> guard(threadsLock);
+		local->id = threads.size()+1;
+		threads.push_back(local);
+	}
+	cpu_event &event = local->events[local->next];
+	event.name = name;
+	event.start = start;
+	event.end = end;
+	if (++local->next == CPU_PROFILER_EVENTS) {
+		local->next = 0;
+		local->wrapped = true;
+	}
+}
+
+void CpuProfiler::frameMark()
+{
+	frameStarts[frameCount % CPU_PROFILER_FRAMES] = now();
+	frameCount++;
+}
+
+bool CpuProfiler::writeTrace(const std::string &filename, int frames)
+{
+	FILE *file = fopen(filename.c_str(), "w");
+	if (file == nullptr) {
+		fprintf(stderr, "Cannot write %s\n", filename.c_str());
+		return false;
+	}
+
+	// Start of the oldest frame asked for
+	int64_t since = 0;
+	unsigned int kept = std::min(frameCount, (unsigned int)CPU_PROFILER_FRAMES);
+	if (frames > 0 && (unsigned int)frames < kept)
+		since = frameStarts[(frameCount-frames) % CPU_PROFILER_FRAMES];
+	else if (frameCount > kept)
+		since = frameStarts[frameCount % CPU_PROFILER_FRAMES];
+
+	// Complete events with microsecond times
+	fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	bool first = true;
+	size_t written = 0;
+	std::lock_guard<std::mutex> guard(threadsLock);
+	for (size_t t=0;t<threads.size();t++) {
+		const thread_events &ring = *threads[t];
+		fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+				first ? "" : ",\n", ring.id, (ring.id == 1) ? "main" : "worker");
+		first = false;
+		size_t count = ring.wrapped ? CPU_PROFILER_EVENTS : ring.next;
+		size_t oldest = ring.wrapped ? ring.next : 0;
+		for (size_t i=0;i<count;i++) {
+			const cpu_event &event = ring.events[(oldest+i) % CPU_PROFILER_EVENTS];
+			if (event.end < since)
+				continue;
+			fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+					event.name, ring.id, event.start/1000.0, (event.end-event.start)/1000.0);
+			written++;
+		}
+	}
+	for (unsigned int f=frameCount-std::min(frameCount, kept);f<frameCount;f++) {
+		int64_t start = frameStarts[f % CPU_PROFILER_FRAMES];
+		if (start >= since)
+			fprintf(file, ",\n{\"name\": \"frame %u\", \"ph\": \"i\", \"s\": \"g\", \"pid\": 1, \"tid\": 1, \"ts\": %.3f}", f, start/1000.0);
+	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+	printf("CPU trace: %zu scopes written to %s\n", written, filename.c_str());
+	return true;
+}
+
+void benchmark_cpu_profiler()
+{
+#ifndef NO_CPU_PROFILER
+	const int count = 1000000;
+	// The ring is allocated by the first scope, keep it out of the timing
+	{
+		PROFILE_SCOPE("warm up");
+	}
+	int64_t start = CpuProfiler::now();
+	for (int i=0;i<count;i++) {
+		PROFILE_SCOPE("empty");
+	}
+	double scope = (double)(CpuProfiler::now()-start)/count;
+	start = CpuProfiler::now();
+	for (int i=0;i<count;i++)
+		CpuProfiler::now();
+	double clock = (double)(CpuProfiler::now()-start)/count;
+	printf("CPU profiler: %.1f ns per scope (clock read %.1f ns)\n", scope, clock);
+#else
+	printf("CPU profiler is compiled out (NO_CPU_PROFILER)\n");
+#endif
+}
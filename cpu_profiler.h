@@ -0,0 +1,48 @@
+#ifndef CPU_PROFILER_H
+#define CPU_PROFILER_H
+
+#include <cstdint>
+#include <string>
+
+#define CPU_PROFILER_EVENTS 65536		// scopes kept per thread, older ones are overwritten
+#define CPU_PROFILER_FRAMES 1024		// frame starts kept
+
+// Scoped CPU time markers. PROFILE_SCOPE("name") times the rest of the enclosing block
+// and writes one event into a ring buffer of the calling thread, so recording never
+// locks or allocates (except the ring itself, once per thread). writeTrace() turns the
+// last frames into Chrome trace-event JSON (chrome://tracing or ui.perfetto.dev).
+// Names must be string literals, only the pointer is kept.
+// Build with NO_CPU_PROFILER defined and the markers compile to nothing.
+class CpuProfiler{
+public:
+	// Nanoseconds since the program started
+	static int64_t now();
+	static void record(const char *name, int64_t start, int64_t end);
+	// Call at the start of every frame on the main thread
+	static void frameMark();
+	// Scopes of every thread which ended in the last `frames` frames.
+	// Other threads must not record while it is writing
+	static bool writeTrace(const std::string &filename, int frames);
+};
+
+struct cpu_scope{
+	cpu_scope(const char *name): name(name), start(CpuProfiler::now()) {}
+	~cpu_scope() { CpuProfiler::record(name, start, CpuProfiler::now()); }
+	const char *name;
+	int64_t start;
+};
+
+#ifndef NO_CPU_PROFILER
+	#define PROFILE_JOIN2(a, b) a##b
+	#define PROFILE_JOIN(a, b) PROFILE_JOIN2(a, b)
+	#define PROFILE_SCOPE(name) cpu_scope PROFILE_JOIN(profileScope, __LINE__)(name)
+	#define PROFILE_FRAME() CpuProfiler::frameMark()
+#else
+	#define PROFILE_SCOPE(name)
+	#define PROFILE_FRAME()
+#endif
+
+// Time empty scopes and print the cost of one
+void benchmark_cpu_profiler();
+
+#endif // CPU_PROFILER_H
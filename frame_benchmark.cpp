@@ -0,0 +1,224 @@
+#include "frame_benchmark.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+static double now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The extension has no functions, so glew doesn't see it in a core profile
+static bool hasExtension(const char *name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i=0;i<count;i++)
+		if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+			return true;
+	return false;
+}
+
+void FrameBenchmark::init()
+{
+	statistics = hasExtension("GL_ARB_pipeline_statistics_query");
+	for (int i=0;i<BENCHMARK_QUERIES;i++) {
+		glGenQueries(1, &queries[i].query);
+		queries[i].fragments = 0;
+		if (statistics)
+			glGenQueries(1, &queries[i].fragments);
+		queries[i].used = false;
+		queries[i].recorded = false;
+	}
+}
+
+void FrameBenchmark::release()
+{
+	for (int i=0;i<BENCHMARK_QUERIES;i++) {
+		glDeleteQueries(1, &queries[i].query);
+		if (statistics)
+			glDeleteQueries(1, &queries[i].fragments);
+	}
+}
+
+void FrameBenchmark::addInfo(const std::string &key, const std::string &value)
+{
+	info.push_back(std::make_pair(key, value));
+}
+
+void FrameBenchmark::beginCase(const std::string &shading, const std::string &post)
+{
+	for (active=0;active<cases.size();active++)
+		if (cases[active].shading == shading && cases[active].post == post)
+			break;
+	if (active == cases.size()) {
+		benchmark_case c;
+		c.shading = shading;
+		c.post = post;
+		cases.push_back(c);
+	}
+	cases[active].cpuStart = cases[active].cpu.size();
+	cases[active].gpuStart = cases[active].gpu.size();
+}
+
+void FrameBenchmark::beginFrame()
+{
+	current = frame % BENCHMARK_QUERIES;
+	collect(queries[current]);
+	glBeginQuery(GL_TIME_ELAPSED, queries[current].query);
+	if (statistics)
+		glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, queries[current].fragments);
+	frameStart = now();
+}
+
+void FrameBenchmark::endFrame(bool recorded)
+{
+	glEndQuery(GL_TIME_ELAPSED);
+	if (statistics)
+		glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+	if (recorded)
+		cases[active].cpu.push_back((now()-frameStart)*1000.0);
+	queries[current].used = true;
+	queries[current].recorded = recorded;
+	frame++;
+}
+
+void FrameBenchmark::endCase()
+{
+	// Oldest first, so GPU times stay in frame order
+	for (int i=1;i<=BENCHMARK_QUERIES;i++)
+		collect(queries[(current+i) % BENCHMARK_QUERIES]);
+
+	benchmark_case &c = cases[active];
+	c.cpuRepeats.push_back(summarize(std::vector<double>(c.cpu.begin()+c.cpuStart, c.cpu.end())).p50);
+	c.gpuRepeats.push_back(summarize(std::vector<double>(c.gpu.begin()+c.gpuStart, c.gpu.end())).p50);
+}
+
+int FrameBenchmark::unstableCases() const
+{
+	int count = 0;
+	for (size_t i=0;i<cases.size();i++)
+		if (summarizeRepeats(cases[i].gpuRepeats).deviation > BENCHMARK_MAX_DEVIATION)
+			count++;
+	return count;
+}
+
+// Read the result of a query from an earlier frame, waits if it is not there yet
+void FrameBenchmark::collect(pending_query &slot)
+{
+	if (!slot.used)
+		return;
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(slot.query, GL_QUERY_RESULT, &elapsed);
+	if (slot.recorded)
+		cases[active].gpu.push_back(elapsed/1000000.0);
+	if (statistics) {
+		GLuint64 fragments = 0;
+		glGetQueryObjectui64v(slot.fragments, GL_QUERY_RESULT, &fragments);
+		if (slot.recorded)
+			cases[active].fragments.push_back(fragments);
+	}
+	slot.used = false;
+}
+
+// Percentiles are nearest-rank
+timing_summary FrameBenchmark::summarize(std::vector<double> times)
+{
+	timing_summary s = {0.0, 0.0, 0.0, 0.0, 0.0};
+	if (times.empty())
+		return s;
+	std::sort(times.begin(), times.end());
+	double sum = 0.0;
+	for (size_t i=0;i<times.size();i++)
+		sum += times[i];
+	size_t n = times.size();
+	s.mean = sum/n;
+	s.p50 = times[std::max((size_t)ceil(0.50*n), (size_t)1)-1];
+	s.p95 = times[std::max((size_t)ceil(0.95*n), (size_t)1)-1];
+	s.p99 = times[std::max((size_t)ceil(0.99*n), (size_t)1)-1];
+	s.max = times[n-1];
+	return s;
+}
+
+repeat_summary FrameBenchmark::summarizeRepeats(std::vector<double> p50s)
+{
+	repeat_summary s = {0.0, 0.0};
+	if (p50s.empty())
+		return s;
+	std::sort(p50s.begin(), p50s.end());
+	size_t n = p50s.size();
+	s.median = (n % 2) ? p50s[n/2] : 0.5*(p50s[n/2-1]+p50s[n/2]);
+	if (s.median > 0.0)
+		s.deviation = std::max(s.median-p50s[0], p50s[n-1]-s.median)/s.median*100.0;
+	return s;
+}
+
+static void writeRepeats(FILE *file, const char *name, const std::vector<double> &p50s)
+{
+	repeat_summary s = FrameBenchmark::summarizeRepeats(p50s);
+	fprintf(file, "\"%s\": {\"median\": %.4f, \"deviation_pct\": %.2f, \"p50s\": [", name, s.median, s.deviation);
+	for (size_t i=0;i<p50s.size();i++)
+		fprintf(file, "%s%.4f", i ? ", " : "", p50s[i]);
+	fprintf(file, "]}");
+}
+
+static void writeSummary(FILE *file, const char *name, const timing_summary &s, int decimals = 4)
+{
+	fprintf(file, "\"%s\": {\"mean\": %.*f, \"p50\": %.*f, \"p95\": %.*f, \"p99\": %.*f, \"max\": %.*f}",
+			name, decimals, s.mean, decimals, s.p50, decimals, s.p95, decimals, s.p99, decimals, s.max);
+}
+
+bool FrameBenchmark::writeJson(const std::string &filename) const
+{
+	FILE *file = fopen(filename.c_str(), "w");
+	if (file == nullptr) {
+		fprintf(stderr, "Cannot write %s\n", filename.c_str());
+		return false;
+	}
+	fprintf(file, "{\n");
+	for (size_t i=0;i<info.size();i++)
+		fprintf(file, "  \"%s\": %s,\n", info[i].first.c_str(), info[i].second.c_str());
+	fprintf(file, "  \"max_deviation_pct\": %.1f,\n", BENCHMARK_MAX_DEVIATION);
+	fprintf(file, "  \"unstable_cases\": %d,\n", unstableCases());
+	fprintf(file, "  \"cases\": [\n");
+	for (size_t i=0;i<cases.size();i++) {
+		const benchmark_case &c = cases[i];
+		bool unstable = summarizeRepeats(c.gpuRepeats).deviation > BENCHMARK_MAX_DEVIATION;
+		fprintf(file, "    {\"shading\": \"%s\", \"post\": \"%s\", \"frames\": %zu, \"repeats\": %zu, \"unstable\": %s,\n     ",
+				c.shading.c_str(), c.post.c_str(), c.cpu.size(), c.gpuRepeats.size(), unstable ? "true" : "false");
+		writeSummary(file, "cpu_ms", summarize(c.cpu));
+		fprintf(file, ",\n     ");
+		writeSummary(file, "gpu_ms", summarize(c.gpu));
+		fprintf(file, ",\n     ");
+		writeRepeats(file, "cpu_p50_repeats_ms", c.cpuRepeats);
+		fprintf(file, ",\n     ");
+		writeRepeats(file, "gpu_p50_repeats_ms", c.gpuRepeats);
+		if (!c.fragments.empty()) {
+			fprintf(file, ",\n     ");
+			writeSummary(file, "fs_invocations", summarize(c.fragments), 0);
+		}
+		fprintf(file, "}%s\n", (i+1 < cases.size()) ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+	fclose(file);
+	return true;
+}
+
+void FrameBenchmark::print() const
+{
+	for (size_t i=0;i<cases.size();i++) {
+		timing_summary cpu = summarize(cases[i].cpu);
+		timing_summary gpu = summarize(cases[i].gpu);
+		repeat_summary repeats = summarizeRepeats(cases[i].gpuRepeats);
+		printf("%-8s %-13s cpu p50 %.3f ms p99 %.3f ms, gpu p50 %.3f ms p99 %.3f ms, repeats %.3f ms +-%.1f%%",
+				cases[i].shading.c_str(), cases[i].post.c_str(), cpu.p50, cpu.p99, gpu.p50, gpu.p99, repeats.median, repeats.deviation);
+		if (!cases[i].fragments.empty())
+			printf(", fs invocations %.0f", summarize(cases[i].fragments).p50);
+		printf("%s\n", repeats.deviation > BENCHMARK_MAX_DEVIATION ? "  UNSTABLE" : "");
+	}
+	int unstable = unstableCases();
+	if (unstable > 0)
+		printf("%d of %zu cases are unstable, their repeats are more than %.0f%% apart\n", unstable, cases.size(), BENCHMARK_MAX_DEVIATION);
+}
@@ -0,0 +1,86 @@
+#ifndef FRAME_BENCHMARK_H
+#define FRAME_BENCHMARK_H
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+
+// GPU frame times are read this many frames late, so reading them doesn't wait for the GPU
+#define BENCHMARK_QUERIES 4
+// A case is unstable when the p50 of one of its repeats is further than this many
+// percent from the median of them
+#define BENCHMARK_MAX_DEVIATION 5.0
+
+struct timing_summary{
+	double mean, p50, p95, p99, max;	// milliseconds
+};
+
+// p50 of every repeat of a case
+struct repeat_summary{
+	double median;			// milliseconds
+	double deviation;		// largest distance of a repeat from the median, percent of it
+};
+
+// Frame times of a benchmark run, one case per shading mode and post-processing
+// setting. CPU time is the wall time from beginFrame() to endFrame(), GPU time is a
+// GL_TIME_ELAPSED query over the same commands. With ARB_pipeline_statistics_query
+// the fragment shader invocations of the frame are counted too.
+// A case can be run several times, beginCase() with the same names adds a repeat.
+// Besides the summary of all frames, the median of the p50s of the repeats and how far
+// they spread is reported, and cases spreading more than BENCHMARK_MAX_DEVIATION are
+// flagged unstable. Results are written as JSON.
+class FrameBenchmark{
+public:
+	FrameBenchmark(): current(0), frame(0), statistics(false), active(0) {}
+
+	// Must be called with a current GL context
+	void init();
+	void release();
+
+	// Extra top level fields of the JSON, `value` is written as it is
+	void addInfo(const std::string &key, const std::string &value);
+
+	void beginCase(const std::string &shading, const std::string &post);
+	void beginFrame();
+	// Warm-up frames are rendered but not `recorded`
+	void endFrame(bool recorded);
+	// Waits for the GPU times of the last frames
+	void endCase();
+	// Cases whose repeats spread more than BENCHMARK_MAX_DEVIATION
+	int unstableCases() const;
+
+	bool writeJson(const std::string &filename) const;
+	// One line per case with the medians
+	void print() const;
+
+	static timing_summary summarize(std::vector<double> times);
+	static repeat_summary summarizeRepeats(std::vector<double> p50s);
+
+private:
+	struct benchmark_case{
+		std::string shading, post;
+		std::vector<double> cpu, gpu;
+		std::vector<double> fragments;		// fragment shader invocations
+		std::vector<double> cpuRepeats, gpuRepeats;	// p50 of each repeat
+		size_t cpuStart, gpuStart;			// first frame of the repeat running
+	};
+	struct pending_query{
+		GLuint query;
+		GLuint fragments;
+		bool used;			// GPU time not read yet
+		bool recorded;
+	};
+
+	void collect(pending_query &slot);
+
+	std::vector<std::pair<std::string, std::string> > info;
+	std::vector<benchmark_case> cases;
+	pending_query queries[BENCHMARK_QUERIES];
+	int current;			// query of this frame
+	double frameStart;
+	unsigned int frame;
+	bool statistics;		// fragment shader invocations are counted
+	size_t active;			// case running
+};
+
+#endif // FRAME_BENCHMARK_H
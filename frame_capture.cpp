@@ -0,0 +1,66 @@
+#include "frame_capture.h"
+#include "gl_state.h"
+#include <cstdio>
+
+void FrameCapture::read(int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	stride = ((size_t)width*3+3) & ~(size_t)3;
+	pixels.resize(stride*height);
+
+	glState.bindFramebuffer(0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, pixels.data());
+}
+
+static void put16(unsigned char *p, unsigned int v)
+{
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+}
+
+static void put32(unsigned char *p, unsigned int v)
+{
+	put16(p, v & 0xFFFF);
+	put16(p+2, v >> 16);
+}
+
+bool FrameCapture::writeBmp(const std::string &filename) const
+{
+	FILE *file = fopen(filename.c_str(), "wb");
+	if (file == nullptr) {
+		fprintf(stderr, "Cannot write %s\n", filename.c_str());
+		return false;
+	}
+
+	// BITMAPFILEHEADER and BITMAPINFOHEADER, the same fields load_bmp reads
+	unsigned char header[54] = {'B', 'M'};
+	put32(header+2, 54+pixels.size());		// file size
+	put32(header+10, 54);					// offset of the pixels
+	put32(header+14, 40);					// info header size
+	put32(header+18, width);
+	put32(header+22, height);				// positive, rows are bottom-up
+	put16(header+26, 1);					// planes
+	put16(header+28, 24);					// bits per pixel
+	put32(header+34, pixels.size());		// image size
+	bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+			fwrite(pixels.data(), 1, pixels.size(), file) == pixels.size();
+	fclose(file);
+	if (!ok)
+		fprintf(stderr, "Cannot write %s\n", filename.c_str());
+	return ok;
+}
+
+unsigned long long FrameCapture::checksum() const
+{
+	unsigned long long hash = 1469598103934665603ULL;
+	for (int y=0;y<height;y++) {
+		const unsigned char *row = &pixels[y*stride];
+		for (int x=0;x<width*3;x++) {
+			hash ^= row[x];
+			hash *= 1099511628211ULL;
+		}
+	}
+	return hash;
+}
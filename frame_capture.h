@@ -0,0 +1,27 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+
+// Copy of the default framebuffer after a frame, so batch runs can keep their output.
+// Pixels are stored as bottom-up BGR rows padded to 4 bytes, which is both what
+// glReadPixels returns and the pixel data of a 24-bit BMP.
+class FrameCapture{
+public:
+	FrameCapture(): width(0), height(0), stride(0) {}
+
+	// Read the default framebuffer, call it after the last draw of the frame
+	void read(int width, int height);
+	bool writeBmp(const std::string &filename) const;
+	// FNV-1a 64 of the pixels, row padding is not included
+	unsigned long long checksum() const;
+
+private:
+	int width, height;
+	size_t stride;		// bytes of a row
+	std::vector<unsigned char> pixels;
+};
+
+#endif // FRAME_CAPTURE_H
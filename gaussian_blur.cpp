@@ -0,0 +1,96 @@
+#include "gaussian_blur.h"
+#include "gl_state.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+GaussianBlur::GaussianBlur(): kernelBuffer(0), kernelSigma(-1.0), kernelRadius(0)
+{
+	memset(&kernel, 0, sizeof(kernel));
+}
+
+void GaussianBlur::init()
+{
+	glGenBuffers(1, &kernelBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, kernelBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(kernel), nullptr, GL_DYNAMIC_DRAW);
+	kernelSigma = -1.0;
+}
+
+void GaussianBlur::release()
+{
+	glDeleteBuffers(1, &kernelBuffer);
+	kernelBuffer = 0;
+}
+
+void GaussianBlur::bindProgram(unsigned int program)
+{
+	GLuint index = glGetUniformBlockIndex(program, "BlurKernel");
+	if (index != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, index, BLUR_BLOCK_BINDING);
+}
+
+void GaussianBlur::setSigma(double sigma)
+{
+	if (sigma == kernelSigma)
+		return;
+	kernelSigma = sigma;
+
+	// Weights of the texels 0..radius of one side, normalized over both sides
+	double weights[BLUR_MAX_RADIUS+2] = {1.0};
+	kernelRadius = (sigma > 0.0) ? std::min((int)ceil(3.0*sigma), BLUR_MAX_RADIUS) : 0;
+	double sum = 1.0;
+	for (int i=1;i<=kernelRadius;i++) {
+		weights[i] = exp(-i*i/(2.0*sigma*sigma));
+		sum += 2.0*weights[i];
+	}
+
+	// Texels i and i+1 become one tap between them, where bilinear filtering
+	// mixes them in the ratio of their weights
+	memset(&kernel, 0, sizeof(kernel));
+	kernel.taps[0][1] = weights[0]/sum;
+	kernel.tapCount = 1;
+	for (int i=1;i<=kernelRadius;i+=2) {
+		double weight = weights[i]+weights[i+1];
+		kernel.taps[kernel.tapCount][0] = (i*weights[i] + (i+1)*weights[i+1])/weight;
+		kernel.taps[kernel.tapCount][1] = weight/sum;
+		kernel.tapCount++;
+	}
+	kernel.reach = kernelRadius+1;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, kernelBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(kernel), &kernel);
+}
+
+// Linear filtering of the source is what lets one tap read two texels
+void GaussianBlur::pass(GLuint program, GLuint vao, GLuint source, int x0, int y0, int x1, int y1)
+{
+	if (x0 >= x1 || y0 >= y1)
+		return;
+	glBindBufferBase(GL_UNIFORM_BUFFER, BLUR_BLOCK_BINDING, kernelBuffer);
+	glViewport(x0, y0, x1-x0, y1-y0);
+	glState.bindVertexArray(vao);
+	glState.setDepthTest(false);
+	glState.useProgram(program);
+	glState.bindTexture(0, source);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+void GaussianBlur::dispatch(GLuint program, GLuint source, GLuint target, bool horizontal, int x0, int y0, int x1, int y1)
+{
+	if (x0 >= x1 || y0 >= y1)
+		return;
+	glBindBufferBase(GL_UNIFORM_BUFFER, BLUR_BLOCK_BINDING, kernelBuffer);
+	glState.useProgram(program);
+	glState.bindTexture(0, source);
+	glBindImageTexture(0, target, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+	// Locations are fixed in csBlur.txt
+	glUniform2i(0, x0, y0);
+	glUniform2i(1, x1, y1);
+	int along = horizontal ? x1-x0 : y1-y0, across = horizontal ? y1-y0 : x1-x0;
+	GLuint tiles = (along+BLUR_TILE-1)/BLUR_TILE, lines = (across+BLUR_LINES-1)/BLUR_LINES;
+	if (horizontal)
+		glDispatchCompute(tiles, lines, 1);
+	else
+		glDispatchCompute(lines, tiles, 1);
+}
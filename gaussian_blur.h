@@ -0,0 +1,60 @@
+#ifndef GAUSSIAN_BLUR_H
+#define GAUSSIAN_BLUR_H
+
+#include <GL/glew.h>
+
+#define BLUR_BLOCK_BINDING 2		// next to the binding points of uniform_blocks.h
+#define BLUR_MAX_RADIUS 48			// 3 sigma of the largest stdDev (16)
+#define BLUR_MAX_TAPS (1+(BLUR_MAX_RADIUS+1)/2)	// center and one tap per pair of texels
+#define BLUR_TILE 64				// texels along the axis blurred by one work group of csBlur.txt
+#define BLUR_LINES 4				// lines across the axis of one work group
+
+// std140 layout of "BlurKernel" in fsBlur.txt and csBlur.txt
+struct blur_kernel_block{
+	GLfloat taps[BLUR_MAX_TAPS][4];	// offset in texels, weight; taps[0] is the center
+	GLint tapCount;
+	GLint reach;					// texels read on each side, one more than the radius
+	GLint pad[2];
+};
+
+// Separable Gaussian blur of a rectangle of a texture, one horizontal and one
+// vertical pass, each drawn into a target the caller binds (see the lens passes in
+// main.cpp). The horizontal pass must cover `radius` more rows above and below the
+// rectangle, the vertical pass reads them.
+// The weights of the 2*radius+1 texels of an axis are folded in pairs into bilinear
+// taps between two texels, so a pass reads radius+1 texels with (radius+1)/2+1 taps.
+// The kernel is rebuilt and uploaded only when sigma changes.
+// With GL 4.3 the passes can also run as compute shaders, see dispatch().
+class GaussianBlur{
+public:
+	GaussianBlur();
+
+	// Must be called with a current GL context
+	void init();
+	void release();
+
+	// Connect the kernel block of `program` to its binding point, once after linking
+	static void bindProgram(unsigned int program);
+
+	// Sigma in texels, the radius is 3 sigma up to BLUR_MAX_RADIUS
+	void setSigma(double sigma);
+	int radius() const { return kernelRadius; }
+	int tapCount() const { return kernel.tapCount; }
+
+	// Blur the pixels [x0, x1) x [y0, y1) of `source` along one axis into the bound
+	// framebuffer, with the permutation of fsBlur.txt for that axis. Pixels outside the
+	// rectangle are left alone. Changes the viewport
+	void pass(GLuint program, GLuint vao, GLuint source, int x0, int y0, int x1, int y1);
+	// The same with the permutation of csBlur.txt, into `target` bound as an image of
+	// GL_RGBA8. A work group fetches the texels its taps read into shared memory once,
+	// instead of every pixel fetching all of them
+	void dispatch(GLuint program, GLuint source, GLuint target, bool horizontal, int x0, int y0, int x1, int y1);
+
+private:
+	GLuint kernelBuffer;
+	double kernelSigma;			// sigma the kernel was built with
+	int kernelRadius;
+	blur_kernel_block kernel;
+};
+
+#endif // GAUSSIAN_BLUR_H
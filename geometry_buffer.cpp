@@ -0,0 +1,169 @@
+#include "geometry_buffer.h"
+#include "gl_state.h"
+#include "cpu_profiler.h"
+#include <algorithm>
+
+// Interleaved vertex: position, texcoord, normal
+#define VERTEX_FLOATS 8
+#define VERTEX_SIZE (VERTEX_FLOATS*sizeof(GLfloat))
+
+void GeometryBuffer::init()
+{
+	glGenVertexArrays(1, &vertexArray);
+}
+
+void GeometryBuffer::release()
+{
+	glDeleteVertexArrays(1, &vertexArray);
+	glState.deletedVertexArray(vertexArray);
+	glDeleteBuffers(1, &vbo);
+	glDeleteBuffers(1, &ebo);
+	vertexArray = vbo = ebo = 0;
+	vertexCapacity = indexCapacity = vertexCount = indexCount = 0;
+	meshes.clear();
+}
+
+size_t GeometryBuffer::bytes() const
+{
+	return vertexCount*VERTEX_SIZE + indexCount*sizeof(GLuint);
+}
+
+// Replace `buffer` by one of `newSize` bytes holding the first `used` bytes of it
+static GLuint grow(GLuint buffer, size_t used, size_t newSize)
+{
+	GLuint bigger;
+	glGenBuffers(1, &bigger);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, bigger);
+	glBufferData(GL_COPY_WRITE_BUFFER, newSize, nullptr, GL_STATIC_DRAW);
+	if (buffer && used) {
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+	}
+	glDeleteBuffers(1, &buffer);
+	return bigger;
+}
+
+void GeometryBuffer::reserve(size_t vertices, size_t indices)
+{
+	bool changed = false;
+	if (vertices > vertexCapacity) {
+		size_t capacity = std::max(vertices, vertexCapacity*2);
+		vbo = grow(vbo, vertexCount*VERTEX_SIZE, capacity*VERTEX_SIZE);
+		vertexCapacity = capacity;
+		changed = true;
+	}
+	if (indices > indexCapacity) {
+		size_t capacity = std::max(indices, indexCapacity*2);
+		ebo = grow(ebo, indexCount*sizeof(GLuint), capacity*sizeof(GLuint));
+		indexCapacity = capacity;
+		changed = true;
+	}
+	if (changed)
+		setupVertexArray();
+}
+
+// Point the VAO at the current buffers
+void GeometryBuffer::setupVertexArray()
+{
+	glState.bindVertexArray(vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	// position (location=0), texcoord (location=1), normal (location=2)
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, VERTEX_SIZE, (GLvoid*)0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, VERTEX_SIZE, (GLvoid*)(3*sizeof(GLfloat)));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, VERTEX_SIZE, (GLvoid*)(5*sizeof(GLfloat)));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+	glState.bindVertexArray(0);
+}
+
+int GeometryBuffer::add(const tinyobj::mesh_t &mesh)
+{
+	PROFILE_SCOPE("mesh upload");
+	size_t vertices = mesh.positions.size()/3;
+	reserve(vertexCount+vertices, indexCount+mesh.indices.size());
+
+	// Missing texcoords or normals are left zero
+	std::vector<GLfloat> interleaved(vertices*VERTEX_FLOATS, 0.0f);
+	for (size_t v=0;v<vertices;v++) {
+		GLfloat *dst = &interleaved[v*VERTEX_FLOATS];
+		for (int c=0;c<3;c++)
+			dst[c] = mesh.positions[3*v+c];
+		if (mesh.texcoords.size() >= 2*(v+1))
+			for (int c=0;c<2;c++)
+				dst[3+c] = mesh.texcoords[2*v+c];
+		if (mesh.normals.size() >= 3*(v+1))
+			for (int c=0;c<3;c++)
+				dst[5+c] = mesh.normals[3*v+c];
+	}
+
+	// Bounding sphere around the center of the bounding box
+	glm::vec3 lo(0.0f), hi(0.0f);
+	for (size_t v=0;v<vertices;v++) {
+		glm::vec3 p(mesh.positions[3*v], mesh.positions[3*v+1], mesh.positions[3*v+2]);
+		lo = v ? glm::min(lo, p) : p;
+		hi = v ? glm::max(hi, p) : p;
+	}
+	glm::vec3 center = (lo+hi)*0.5f;
+	float radius = 0.0f;
+	for (size_t v=0;v<vertices;v++)
+		radius = std::max(radius, glm::distance(center, glm::vec3(mesh.positions[3*v], mesh.positions[3*v+1], mesh.positions[3*v+2])));
+
+	mesh_range range;
+	range.bounds = glm::vec4(center, radius);
+	range.firstIndex = indexCount;
+	range.indexCount = mesh.indices.size();
+	range.baseVertex = vertexCount;
+	range.vertexCount = vertices;
+
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferSubData(GL_ARRAY_BUFFER, vertexCount*VERTEX_SIZE, interleaved.size()*sizeof(GLfloat), interleaved.data());
+	// The element buffer is VAO state, so go through the copy target
+	glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, indexCount*sizeof(GLuint), mesh.indices.size()*sizeof(GLuint), mesh.indices.data());
+
+	vertexCount += vertices;
+	indexCount += mesh.indices.size();
+	meshes.push_back(range);
+	return meshes.size()-1;
+}
+
+bool GeometryBuffer::indirectSupported()
+{
+	// baseInstance of the commands needs GL 4.2 or ARB_base_instance
+	return GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+}
+
+void GeometryBuffer::addCommand(int mesh, GLuint firstInstance, GLuint instanceCount)
+{
+	draw_command command;
+	command.count = meshes[mesh].indexCount;
+	command.instanceCount = instanceCount;
+	command.firstIndex = meshes[mesh].firstIndex;
+	command.baseVertex = meshes[mesh].baseVertex;
+	command.baseInstance = firstInstance;
+	commands.push_back(command);
+}
+
+void GeometryBuffer::uploadCommands(StreamBuffer &stream, GLuint instanceBase)
+{
+	if (commands.empty())
+		return;
+	draw_command *dst = (draw_command*)stream.allocate(commands.size()*sizeof(draw_command), sizeof(draw_command), commandOffset);
+	if (dst == nullptr)
+		return;
+	// Mapped memory is write only, so finish every command before it is stored
+	for (size_t i=0;i<commands.size();i++) {
+		draw_command command = commands[i];
+		command.baseInstance += instanceBase;
+		dst[i] = command;
+	}
+	commandBuffer = stream.buffer();
+}
+
+void GeometryBuffer::multiDraw(size_t first, size_t count)
+{
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (GLvoid*)(commandOffset+first*sizeof(draw_command)), count, 0);
+}
@@ -0,0 +1,76 @@
+#ifndef GEOMETRY_BUFFER_H
+#define GEOMETRY_BUFFER_H
+
+#include <GL/glew.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include "tiny_obj_loader.h"
+#include "stream_buffer.h"
+
+// Where a mesh lives inside the shared buffers
+struct mesh_range{
+	GLuint firstIndex;		// in the index buffer
+	GLuint indexCount;
+	GLint baseVertex;		// added to every index of the mesh
+	GLuint vertexCount;
+	glm::vec4 bounds;		// bounding sphere in model space, center and radius
+};
+
+// Layout of one command of glMultiDrawElementsIndirect
+struct draw_command{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// All meshes packed into one vertex buffer and one index buffer with one VAO.
+// Vertices are interleaved position, texcoord and normal; indices stay relative to
+// the mesh and are offset by the base vertex when drawing.
+// Buffers grow by doubling, old content is moved with glCopyBufferSubData.
+// Draw commands of a frame are collected on the CPU, written into the stream buffer
+// and submitted with glMultiDrawElementsIndirect (GL 4.3 or ARB_multi_draw_indirect).
+class GeometryBuffer{
+public:
+	GeometryBuffer(): vertexArray(0), vbo(0), ebo(0), commandBuffer(0),
+		vertexCapacity(0), indexCapacity(0), vertexCount(0), indexCount(0), commandOffset(0) {}
+
+	void init();
+	void release();
+
+	// Append a mesh, returns its id
+	int add(const tinyobj::mesh_t &mesh);
+	const mesh_range &mesh(int id) const { return meshes[id]; }
+	GLuint vao() const { return vertexArray; }
+	// Bytes of vertex and index data in use
+	size_t bytes() const;
+
+	static bool indirectSupported();
+	void clearCommands() { commands.clear(); }
+	void reserveCommands(size_t count) { commands.reserve(count); }
+	// Draw `instanceCount` instances of `mesh`, starting at instance `firstInstance`
+	void addCommand(int mesh, GLuint firstInstance, GLuint instanceCount);
+	size_t commandCount() const { return commands.size(); }
+	// Stream buffer bytes needed by uploadCommands()
+	size_t commandsSize() const { return (commands.size()+1)*sizeof(draw_command); }
+	// Write the commands of this frame into the stream buffer, their base instance
+	// counts from `instanceBase`
+	void uploadCommands(StreamBuffer &stream, GLuint instanceBase);
+	// Submit `count` commands starting at `first` with one call, VAO must be bound
+	void multiDraw(size_t first, size_t count);
+
+private:
+	void reserve(size_t vertices, size_t indices);
+	void setupVertexArray();
+
+	GLuint vertexArray, vbo, ebo;
+	GLuint commandBuffer;			// stream buffer of this frame
+	size_t vertexCapacity, indexCapacity;
+	size_t vertexCount, indexCount;
+	size_t commandOffset;
+	std::vector<mesh_range> meshes;
+	std::vector<draw_command> commands;
+};
+
+#endif // GEOMETRY_BUFFER_H
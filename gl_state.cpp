@@ -0,0 +1,147 @@
+#include "gl_state.h"
+
+// Value of a cached binding we know nothing about
+#define UNKNOWN 0xFFFFFFFFu
+
+GLState glState;
+
+GLState::GLState()
+{
+	reset();
+	stat.issued = stat.filtered = 0;
+}
+
+void GLState::reset()
+{
+	program = vao = activeUnit = drawFramebuffer = readFramebuffer = UNKNOWN;
+	for (int i=0;i<MAX_TEXTURE_UNITS;i++)
+		textures[i] = UNKNOWN;
+	depthTest = blend = -1;
+	blendSrc = blendDst = UNKNOWN;
+}
+
+void GLState::beginFrame()
+{
+	stat.issued = stat.filtered = 0;
+}
+
+// Update the cache, return true if the call must be issued
+bool GLState::changed(GLuint &cache, GLuint value)
+{
+	if (cache == value) {
+		stat.filtered++;
+		return false;
+	}
+	cache = value;
+	stat.issued++;
+	return true;
+}
+
+void GLState::useProgram(GLuint program)
+{
+	if (changed(this->program, program))
+		glUseProgram(program);
+}
+
+void GLState::bindVertexArray(GLuint vao)
+{
+	if (changed(this->vao, vao))
+		glBindVertexArray(vao);
+}
+
+void GLState::bindTexture(GLuint unit, GLuint texture)
+{
+	if (unit >= MAX_TEXTURE_UNITS) {
+		glActiveTexture(GL_TEXTURE0+unit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		activeUnit = UNKNOWN;
+		stat.issued += 2;
+		return;
+	}
+	if (textures[unit] == texture) {
+		stat.filtered++;
+		return;
+	}
+	// Active unit is only switched when a binding really changes
+	if (changed(activeUnit, unit))
+		glActiveTexture(GL_TEXTURE0+unit);
+	textures[unit] = texture;
+	stat.issued++;
+	glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+void GLState::editTexture(GLuint texture)
+{
+	bindTexture(0, texture);
+	if (changed(activeUnit, 0))
+		glActiveTexture(GL_TEXTURE0);
+}
+
+void GLState::bindFramebuffer(GLuint framebuffer)
+{
+	bindFramebuffers(framebuffer, framebuffer);
+}
+
+void GLState::bindFramebuffers(GLuint draw, GLuint read)
+{
+	// One call if both targets change to the same framebuffer
+	if (draw == read && drawFramebuffer != draw && readFramebuffer != read) {
+		drawFramebuffer = readFramebuffer = draw;
+		stat.issued++;
+		glBindFramebuffer(GL_FRAMEBUFFER, draw);
+		return;
+	}
+	if (changed(drawFramebuffer, draw))
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw);
+	if (changed(readFramebuffer, read))
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, read);
+}
+
+void GLState::setCapability(GLenum cap, int &cache, bool enable)
+{
+	if (cache == (int)enable) {
+		stat.filtered++;
+		return;
+	}
+	cache = enable;
+	stat.issued++;
+	if (enable)
+		glEnable(cap);
+	else
+		glDisable(cap);
+}
+
+void GLState::setDepthTest(bool enable)
+{
+	setCapability(GL_DEPTH_TEST, depthTest, enable);
+}
+
+void GLState::setBlend(bool enable)
+{
+	setCapability(GL_BLEND, blend, enable);
+}
+
+void GLState::setBlendFunc(GLenum src, GLenum dst)
+{
+	if (blendSrc == src && blendDst == dst) {
+		stat.filtered++;
+		return;
+	}
+	blendSrc = src;
+	blendDst = dst;
+	stat.issued++;
+	glBlendFunc(src, dst);
+}
+
+void GLState::deletedTexture(GLuint texture)
+{
+	for (int i=0;i<MAX_TEXTURE_UNITS;i++)
+		if (textures[i] == texture)
+			textures[i] = 0;
+}
+
+void GLState::deletedVertexArray(GLuint vao)
+{
+	if (this->vao == vao)
+		this->vao = 0;
+}
@@ -0,0 +1,63 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <GL/glew.h>
+
+#define MAX_TEXTURE_UNITS 16
+
+// Counters of one frame
+struct gl_state_stats{
+	unsigned int issued;		// state changes sent to GL
+	unsigned int filtered;		// state changes dropped because nothing would change
+};
+
+// Thin layer over the GL state we change while rendering.
+// It remembers the current program, VAO, textures of every unit, draw and read framebuffer,
+// depth test and blending, and drops calls which would not change anything.
+// Everything in this program must change these states through glState,
+// otherwise call reset() so the cache forgets what it knows.
+class GLState{
+public:
+	GLState();
+
+	// Forget the cached state, the next change of everything is issued again
+	void reset();
+	// Start counting a new frame
+	void beginFrame();
+	const gl_state_stats &stats() const { return stat; }
+
+	void useProgram(GLuint program);
+	void bindVertexArray(GLuint vao);
+	void bindTexture(GLuint unit, GLuint texture);		// GL_TEXTURE_2D of `unit`
+	// Bind `texture` to unit 0 and make unit 0 active, before glTexImage2D, glTexParameteri
+	// and the like. bindTexture() doesn't switch the active unit when the binding is filtered
+	void editTexture(GLuint texture);
+	void bindFramebuffer(GLuint framebuffer);			// both draw and read framebuffer
+	void bindFramebuffers(GLuint draw, GLuint read);	// e.g. for glBlitFramebuffer
+	void setDepthTest(bool enable);
+	void setBlend(bool enable);
+	void setBlendFunc(GLenum src, GLenum dst);
+
+	// GL unbinds deleted objects by itself, call these after deleting
+	void deletedTexture(GLuint texture);
+	void deletedVertexArray(GLuint vao);
+
+private:
+	bool changed(GLuint &cache, GLuint value);
+	void setCapability(GLenum cap, int &cache, bool enable);
+
+	GLuint program;
+	GLuint vao;
+	GLuint activeUnit;
+	GLuint textures[MAX_TEXTURE_UNITS];
+	GLuint drawFramebuffer, readFramebuffer;
+	int depthTest;		// -1 unknown, 0 disabled, 1 enabled
+	int blend;
+	GLuint blendSrc, blendDst;
+	gl_state_stats stat;
+};
+
+// There is only one context in this program
+extern GLState glState;
+
+#endif // GL_STATE_H
@@ -0,0 +1,185 @@
+#include "gpu_profiler.h"
+#include <cstring>
+
+static void copyName(char *dst, const char *src)
+{
+	strncpy(dst, src, GPU_PROFILER_NAME-1);
+	dst[GPU_PROFILER_NAME-1] = '\0';
+}
+
+GpuProfiler::GpuProfiler(): enabled(false), frame(0), current(0), averageCount(0), dropped(0), exportFile(nullptr)
+{
+	for (int i=0;i<GPU_PROFILER_FRAMES;i++) {
+		slots[i].used = 0;
+		slots[i].frame = 0;
+		slots[i].pending = false;
+	}
+}
+
+void GpuProfiler::init()
+{
+	for (int i=0;i<GPU_PROFILER_FRAMES;i++) {
+		slots[i].queries.resize(2*GPU_PROFILER_MAX_SCOPES);
+		glGenQueries(slots[i].queries.size(), slots[i].queries.data());
+		slots[i].scopes.resize(GPU_PROFILER_MAX_SCOPES);
+	}
+	stack.reserve(GPU_PROFILER_MAX_SCOPES);
+	resolved.reserve(GPU_PROFILER_MAX_SCOPES);
+}
+
+void GpuProfiler::release()
+{
+	// Frames still in flight are waited for, so the export has every frame
+	glFinish();
+	for (int i=1;i<=GPU_PROFILER_FRAMES;i++) {
+		frame_queries &slot = slots[(frame+i-1) % GPU_PROFILER_FRAMES];
+		if (slot.pending)
+			resolve(slot);
+	}
+	for (int i=0;i<GPU_PROFILER_FRAMES;i++) {
+		if (!slots[i].queries.empty())
+			glDeleteQueries(slots[i].queries.size(), slots[i].queries.data());
+		slots[i].queries.clear();
+		slots[i].pending = false;
+	}
+	if (exportFile)
+		fclose(exportFile);
+	exportFile = nullptr;
+}
+
+bool GpuProfiler::exportTo(const std::string &filename)
+{
+	if (exportFile)
+		fclose(exportFile);
+	exportFile = fopen(filename.c_str(), "w");
+	if (exportFile == nullptr) {
+		fprintf(stderr, "Cannot write %s\n", filename.c_str());
+		return false;
+	}
+	fprintf(exportFile, "frame,scope,depth,start_ms,gpu_ms\n");
+	return true;
+}
+
+void GpuProfiler::beginFrame()
+{
+	if (!enabled)
+		return;
+	current = frame % GPU_PROFILER_FRAMES;
+	frame_queries &slot = slots[current];
+	if (slot.pending)
+		resolve(slot);
+	slot.used = 0;
+	slot.frame = frame;
+	stack.clear();
+}
+
+void GpuProfiler::endFrame()
+{
+	if (!enabled)
+		return;
+	// Scopes left open end with the frame
+	while (!stack.empty())
+		end();
+	slots[current].pending = slots[current].used > 0;
+	frame++;
+}
+
+void GpuProfiler::begin(const char *name)
+{
+	if (!enabled)
+		return;
+	frame_queries &slot = slots[current];
+	if (slot.used == GPU_PROFILER_MAX_SCOPES) {
+		stack.push_back(-1);
+		return;
+	}
+	gpu_scope_result &scope = slot.scopes[slot.used];
+	copyName(scope.name, name);
+	scope.depth = stack.size();
+	glQueryCounter(slot.queries[2*slot.used], GL_TIMESTAMP);
+	stack.push_back(slot.used++);
+}
+
+void GpuProfiler::end()
+{
+	if (!enabled || stack.empty())
+		return;
+	int scope = stack.back();
+	stack.pop_back();
+	if (scope >= 0)
+		glQueryCounter(slots[current].queries[2*scope+1], GL_TIMESTAMP);
+}
+
+// Read the timestamps of a finished frame, the frame is dropped if the GPU is not done yet
+void GpuProfiler::resolve(frame_queries &slot)
+{
+	slot.pending = false;
+	// Queries complete in order, so the last one tells about all of them
+	GLint available = GL_FALSE;
+	glGetQueryObjectiv(slot.queries[2*slot.used-1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available) {
+		dropped++;
+		return;
+	}
+
+	GLuint64 frameStart = 0;
+	resolved.resize(slot.used);
+	for (size_t i=0;i<slot.used;i++) {
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(slot.queries[2*i], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(slot.queries[2*i+1], GL_QUERY_RESULT, &end);
+		if (i == 0)
+			frameStart = begin;
+		gpu_scope_result &result = resolved[i];
+		memcpy(result.name, slot.scopes[i].name, sizeof(result.name));
+		result.depth = slot.scopes[i].depth;
+		result.start = (begin-frameStart)/1000000.0;
+		result.time = (end > begin) ? (end-begin)/1000000.0 : 0.0;
+
+		scope_average &avg = *findAverage(result.name);
+		avg.lastFrame = slot.frame;
+		if (avg.count == GPU_PROFILER_WINDOW)
+			avg.sum -= avg.samples[avg.next];
+		else
+			avg.count++;
+		avg.samples[avg.next] = result.time;
+		avg.sum += result.time;
+		avg.next = (avg.next+1) % GPU_PROFILER_WINDOW;
+
+		if (exportFile)
+			fprintf(exportFile, "%u,%s,%d,%.4f,%.4f\n", slot.frame, result.name, result.depth, result.start, result.time);
+	}
+}
+
+// Average of `name`, a new one if it is not there yet
+GpuProfiler::scope_average *GpuProfiler::findAverage(const char *name)
+{
+	int oldest = 0;
+	for (int i=0;i<averageCount;i++) {
+		if (strcmp(averages[i].name, name) == 0)
+			return &averages[i];
+		if (averages[i].lastFrame < averages[oldest].lastFrame)
+			oldest = i;
+	}
+	scope_average &avg = averages[(averageCount < GPU_PROFILER_MAX_SCOPES) ? averageCount++ : oldest];
+	copyName(avg.name, name);
+	avg.count = avg.next = 0;
+	avg.sum = 0.0;
+	return &avg;
+}
+
+double GpuProfiler::average(const char *name) const
+{
+	for (int i=0;i<averageCount;i++)
+		if (strcmp(averages[i].name, name) == 0)
+			return (averages[i].count > 0) ? averages[i].sum/averages[i].count : 0.0;
+	return 0.0;
+}
+
+void GpuProfiler::printAverages() const
+{
+	for (size_t i=0;i<resolved.size();i++)
+		printf("GPU %*s%s: %.3f ms\n", 2*resolved[i].depth, "", resolved[i].name, average(resolved[i].name));
+	if (dropped > 0)
+		printf("GPU profiler: %u frames dropped, results were not ready\n", dropped);
+}
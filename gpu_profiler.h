@@ -0,0 +1,85 @@
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+#include <GL/glew.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define GPU_PROFILER_FRAMES 4			// frames of queries in flight
+#define GPU_PROFILER_MAX_SCOPES 256		// scopes timed per frame, later ones are skipped
+#define GPU_PROFILER_WINDOW 60			// frames in the rolling averages
+#define GPU_PROFILER_NAME 64			// longer scope names are cut
+
+struct gpu_scope_result{
+	char name[GPU_PROFILER_NAME];
+	int depth;			// 0 for scopes which are not inside another scope
+	double start;		// milliseconds after the first scope of the frame started
+	double time;		// milliseconds
+};
+
+// Named GPU time scopes. begin() and end() put a GL_TIMESTAMP query into the command
+// stream, so scopes can be nested. Every frame has its own set of queries in a ring of
+// GPU_PROFILER_FRAMES; a frame is read when its slot comes around again, and only if
+// the GPU is done with it, otherwise the frame is dropped instead of waiting.
+// Results go into rolling averages per scope name and optionally into a CSV file.
+// All storage is made by init(), so recording and reading back never allocate; when
+// more than GPU_PROFILER_MAX_SCOPES names were seen, the one unused longest is dropped.
+class GpuProfiler{
+public:
+	GpuProfiler();
+
+	// Must be called with a current GL context
+	void init();
+	void release();
+	// Nothing is recorded until it is enabled
+	void setEnabled(bool enabled) { this->enabled = enabled; }
+	bool isEnabled() const { return enabled; }
+	// Write every frame read back to `filename`: frame,scope,depth,start_ms,gpu_ms
+	bool exportTo(const std::string &filename);
+
+	void beginFrame();
+	void endFrame();
+	void begin(const char *name);
+	void end();
+
+	// Scopes of the newest frame read back, in the order they began
+	const std::vector<gpu_scope_result> &lastFrame() const { return resolved; }
+	// Average milliseconds of `name` over the last GPU_PROFILER_WINDOW frames it was in
+	double average(const char *name) const;
+	// Averages of the scopes in lastFrame(), nested scopes indented
+	void printAverages() const;
+	unsigned int droppedFrames() const { return dropped; }
+
+private:
+	struct frame_queries{
+		std::vector<GLuint> queries;			// begin and end timestamp of every scope
+		std::vector<gpu_scope_result> scopes;	// name and depth of every scope
+		size_t used;							// scopes recorded
+		unsigned int frame;
+		bool pending;							// not read back yet
+	};
+	struct scope_average{
+		char name[GPU_PROFILER_NAME];
+		double samples[GPU_PROFILER_WINDOW];
+		int count, next;
+		double sum;
+		unsigned int lastFrame;		// last frame it had a sample
+	};
+
+	void resolve(frame_queries &slot);
+	scope_average *findAverage(const char *name);
+
+	bool enabled;
+	unsigned int frame;
+	int current;				// slot of this frame
+	std::vector<int> stack;		// open scopes, -1 for skipped ones
+	frame_queries slots[GPU_PROFILER_FRAMES];
+	std::vector<gpu_scope_result> resolved;
+	scope_average averages[GPU_PROFILER_MAX_SCOPES];
+	int averageCount;
+	unsigned int dropped;
+	FILE *exportFile;
+};
+
+#endif // GPU_PROFILER_H
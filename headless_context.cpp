@@ -0,0 +1,110 @@
+#include "headless_context.h"
+#include <cstdio>
+
+#ifdef USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+	#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+bool HeadlessContext::init(int width, int height)
+{
+	// Surfaceless Mesa needs neither X11 nor a render node
+	EGLDisplay dpy = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay)
+		dpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	if (dpy == EGL_NO_DISPLAY)
+		dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, nullptr, nullptr)) {
+		fprintf(stderr, "Headless: no EGL display\n");
+		return false;
+	}
+	display = dpy;
+
+	const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+		EGL_DEPTH_SIZE, 24,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint count = 0;
+	if (!eglChooseConfig(dpy, configAttribs, &config, 1, &count) || count < 1) {
+		fprintf(stderr, "Headless: no EGL config with a pbuffer\n");
+		release();
+		return false;
+	}
+
+	const EGLint surfaceAttribs[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+	surface = eglCreatePbufferSurface(dpy, config, surfaceAttribs);
+	if (surface == EGL_NO_SURFACE) {
+		fprintf(stderr, "Headless: cannot create a %dx%d pbuffer\n", width, height);
+		surface = nullptr;
+		release();
+		return false;
+	}
+
+	// Same context as the window asks GLFW for
+	eglBindAPI(EGL_OPENGL_API);
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	context = eglCreateContext(dpy, config, EGL_NO_CONTEXT, contextAttribs);
+	if (context == EGL_NO_CONTEXT) {
+		fprintf(stderr, "Headless: cannot create an OpenGL 3.3 core context\n");
+		context = nullptr;
+		release();
+		return false;
+	}
+	if (!eglMakeCurrent(dpy, surface, surface, context)) {
+		fprintf(stderr, "Headless: cannot make the context current\n");
+		release();
+		return false;
+	}
+	return true;
+}
+
+void HeadlessContext::release()
+{
+	if (display == nullptr)
+		return;
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (context)
+		eglDestroyContext(display, context);
+	if (surface)
+		eglDestroySurface(display, surface);
+	eglTerminate(display);
+	display = surface = context = nullptr;
+}
+
+void HeadlessContext::swapBuffers()
+{
+	if (display)
+		eglSwapBuffers(display, surface);
+}
+
+#else
+
+bool HeadlessContext::init(int, int)
+{
+	fprintf(stderr, "Headless mode needs EGL, build with USE_EGL defined\n");
+	return false;
+}
+
+void HeadlessContext::release()
+{
+}
+
+void HeadlessContext::swapBuffers()
+{
+}
+
+#endif // USE_EGL
@@ -0,0 +1,26 @@
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+// GL context without a window system, for batch runs on machines without a display.
+// It is an EGL pbuffer of the requested size, so the default framebuffer exists and
+// render() draws the same way as into a window. On Mesa the surfaceless platform is
+// used, which falls back to llvmpipe when there is no GPU
+// (LIBGL_ALWAYS_SOFTWARE=1 forces it).
+// Only available when built with USE_EGL, init() fails otherwise.
+class HeadlessContext{
+public:
+	HeadlessContext(): display(nullptr), surface(nullptr), context(nullptr) {}
+
+	// Create a GL 3.3 core context with a width x height pbuffer and make it current
+	bool init(int width, int height);
+	void release();
+	void swapBuffers();
+
+private:
+	// EGLDisplay, EGLSurface and EGLContext, so EGL headers stay out of here
+	void *display;
+	void *surface;
+	void *context;
+};
+
+#endif // HEADLESS_CONTEXT_H
@@ -0,0 +1,258 @@
+#include "hud.h"
+#include "gl_state.h"
+#include <cmath>
+#include <cctype>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+// Atlas cells: every font pixel is GLYPH_TEXELS texels, with a border of GLYPH_SPREAD
+// texels around the glyph where the distance falls off
+#define GLYPH_TEXELS 4
+#define GLYPH_SPREAD 4
+#define CELL_WIDTH (5*GLYPH_TEXELS+2*GLYPH_SPREAD)
+#define CELL_HEIGHT (7*GLYPH_TEXELS+2*GLYPH_SPREAD)
+#define ATLAS_COLUMNS 8
+
+// 5x7 font, one byte per row from the top, bit 4 is the left column
+static const char glyphChars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.:/%-+()_#";
+static const unsigned char glyphRows[][7] = {
+	{0x0E,0x11,0x13,0x15,0x19,0x11,0x0E},	// 0
+	{0x04,0x0C,0x04,0x04,0x04,0x04,0x0E},	// 1
+	{0x0E,0x11,0x01,0x02,0x04,0x08,0x1F},	// 2
+	{0x1F,0x02,0x04,0x02,0x01,0x11,0x0E},	// 3
+	{0x02,0x06,0x0A,0x12,0x1F,0x02,0x02},	// 4
+	{0x1F,0x10,0x1E,0x01,0x01,0x11,0x0E},	// 5
+	{0x06,0x08,0x10,0x1E,0x11,0x11,0x0E},	// 6
+	{0x1F,0x01,0x02,0x04,0x08,0x08,0x08},	// 7
+	{0x0E,0x11,0x11,0x0E,0x11,0x11,0x0E},	// 8
+	{0x0E,0x11,0x11,0x0F,0x01,0x02,0x0C},	// 9
+	{0x0E,0x11,0x11,0x1F,0x11,0x11,0x11},	// A
+	{0x1E,0x11,0x11,0x1E,0x11,0x11,0x1E},	// B
+	{0x0E,0x11,0x10,0x10,0x10,0x11,0x0E},	// C
+	{0x1C,0x12,0x11,0x11,0x11,0x12,0x1C},	// D
+	{0x1F,0x10,0x10,0x1E,0x10,0x10,0x1F},	// E
+	{0x1F,0x10,0x10,0x1E,0x10,0x10,0x10},	// F
+	{0x0E,0x11,0x10,0x17,0x11,0x11,0x0F},	// G
+	{0x11,0x11,0x11,0x1F,0x11,0x11,0x11},	// H
+	{0x0E,0x04,0x04,0x04,0x04,0x04,0x0E},	// I
+	{0x07,0x02,0x02,0x02,0x02,0x12,0x0C},	// J
+	{0x11,0x12,0x14,0x18,0x14,0x12,0x11},	// K
+	{0x10,0x10,0x10,0x10,0x10,0x10,0x1F},	// L
+	{0x11,0x1B,0x15,0x15,0x11,0x11,0x11},	// M
+	{0x11,0x11,0x19,0x15,0x13,0x11,0x11},	// N
+	{0x0E,0x11,0x11,0x11,0x11,0x11,0x0E},	// O
+	{0x1E,0x11,0x11,0x1E,0x10,0x10,0x10},	// P
+	{0x0E,0x11,0x11,0x11,0x15,0x12,0x0D},	// Q
+	{0x1E,0x11,0x11,0x1E,0x14,0x12,0x11},	// R
+	{0x0F,0x10,0x10,0x0E,0x01,0x01,0x1E},	// S
+	{0x1F,0x04,0x04,0x04,0x04,0x04,0x04},	// T
+	{0x11,0x11,0x11,0x11,0x11,0x11,0x0E},	// U
+	{0x11,0x11,0x11,0x11,0x11,0x0A,0x04},	// V
+	{0x11,0x11,0x11,0x15,0x15,0x15,0x0A},	// W
+	{0x11,0x11,0x0A,0x04,0x0A,0x11,0x11},	// X
+	{0x11,0x11,0x11,0x0A,0x04,0x04,0x04},	// Y
+	{0x1F,0x01,0x02,0x04,0x08,0x10,0x1F},	// Z
+	{0x00,0x00,0x00,0x00,0x00,0x0C,0x0C},	// .
+	{0x00,0x0C,0x0C,0x00,0x0C,0x0C,0x00},	// :
+	{0x00,0x01,0x02,0x04,0x08,0x10,0x00},	// /
+	{0x18,0x19,0x02,0x04,0x08,0x13,0x03},	// %
+	{0x00,0x00,0x00,0x1F,0x00,0x00,0x00},	// -
+	{0x00,0x04,0x04,0x1F,0x04,0x04,0x00},	// +
+	{0x02,0x04,0x08,0x08,0x08,0x04,0x02},	// (
+	{0x08,0x04,0x02,0x02,0x02,0x04,0x08},	// )
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x1F},	// _
+	{0x1F,0x1F,0x1F,0x1F,0x1F,0x1F,0x1F},	// #
+};
+#define GLYPH_COUNT ((int)sizeof(glyphRows)/7)
+#define SOLID_GLYPH (GLYPH_COUNT-1)		// '#' is a filled box
+
+#define ATLAS_WIDTH (ATLAS_COLUMNS*CELL_WIDTH)
+#define ATLAS_HEIGHT (((GLYPH_COUNT+ATLAS_COLUMNS-1)/ATLAS_COLUMNS)*CELL_HEIGHT)
+
+Hud::Hud(): vao(0), vbo(0), texture(0), vboSize(0), pending(false), instances(0), nextFrame(0),
+		sinceRefresh(HUD_REFRESH_MS), visible(false)
+{
+	for (int i=0;i<HUD_GRAPH_FRAMES;i++)
+		frameTimes[i] = 0.0f;
+}
+
+void Hud::init()
+{
+	buildAtlas();
+
+	glGenVertexArrays(1, &vao);
+	glGenBuffers(1, &vbo);
+	glState.bindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(hud_quad), (GLvoid*)offsetof(hud_quad, x));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(hud_quad), (GLvoid*)offsetof(hud_quad, u0));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(hud_quad), (GLvoid*)offsetof(hud_quad, color));
+	for (int i=0;i<3;i++)
+		glVertexAttribDivisor(i, 1);
+	glState.bindVertexArray(0);
+	quads.reserve(1024);
+}
+
+void Hud::release()
+{
+	glDeleteVertexArrays(1, &vao);
+	glState.deletedVertexArray(vao);
+	glDeleteBuffers(1, &vbo);
+	glDeleteTextures(1, &texture);
+	glState.deletedTexture(texture);
+	vao = vbo = texture = 0;
+	vboSize = 0;
+	instances = 0;
+}
+
+// Signed distance of every texel to the glyph edge, brute force over the spread.
+// It is done once at startup and takes well under a millisecond
+void Hud::buildAtlas()
+{
+	std::vector<unsigned char> atlas(ATLAS_WIDTH*ATLAS_HEIGHT, 0);
+	for (int g=0;g<GLYPH_COUNT;g++) {
+		int cellX = (g % ATLAS_COLUMNS)*CELL_WIDTH, cellY = (g / ATLAS_COLUMNS)*CELL_HEIGHT;
+		for (int y=0;y<CELL_HEIGHT;y++) {
+			for (int x=0;x<CELL_WIDTH;x++) {
+				// Is the texel at (x, y) of the cell inside the glyph
+				#define INSIDE(px, py) ((px) >= GLYPH_SPREAD && (py) >= GLYPH_SPREAD && \
+						(px) < GLYPH_SPREAD+5*GLYPH_TEXELS && (py) < GLYPH_SPREAD+7*GLYPH_TEXELS && \
+						(glyphRows[g][((py)-GLYPH_SPREAD)/GLYPH_TEXELS] >> (4-((px)-GLYPH_SPREAD)/GLYPH_TEXELS) & 1))
+				bool inside = INSIDE(x, y);
+				float nearest = GLYPH_SPREAD;
+				for (int dy=-GLYPH_SPREAD;dy<=GLYPH_SPREAD;dy++) {
+					for (int dx=-GLYPH_SPREAD;dx<=GLYPH_SPREAD;dx++) {
+						int sx = x+dx, sy = y+dy;
+						bool other = (sx >= 0 && sy >= 0 && sx < CELL_WIDTH && sy < CELL_HEIGHT) ? INSIDE(sx, sy) : false;
+						if (other != inside)
+							nearest = std::min(nearest, sqrtf(dx*dx+dy*dy)-0.5f);
+					}
+				}
+				#undef INSIDE
+				float distance = inside ? nearest : -nearest;
+				float value = 0.5f + 0.5f*distance/GLYPH_SPREAD;
+				atlas[(cellY+y)*ATLAS_WIDTH+cellX+x] = (unsigned char)(std::max(0.0f, std::min(1.0f, value))*255.0f+0.5f);
+			}
+		}
+	}
+
+	glGenTextures(1, &texture);
+	glState.editTexture(texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, ATLAS_WIDTH, ATLAS_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, atlas.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void Hud::addFrameTime(float ms)
+{
+	frameTimes[nextFrame] = ms;
+	nextFrame = (nextFrame+1) % HUD_GRAPH_FRAMES;
+	sinceRefresh += ms;
+}
+
+void Hud::begin()
+{
+	quads.clear();
+	// Room for the panel, upload() puts it behind everything else
+	quads.resize(1);
+	pending = true;
+	sinceRefresh = 0.0f;
+}
+
+void Hud::quad(float x, float y, float w, float h, float u0, float v0, float u1, float v1, unsigned int rgba)
+{
+	hud_quad q = {x, y, w, h, u0, v0, u1, v1,
+		{(GLubyte)(rgba >> 24), (GLubyte)(rgba >> 16), (GLubyte)(rgba >> 8), (GLubyte)rgba}};
+	quads.push_back(q);
+}
+
+float Hud::text(float x, float y, const char *str, unsigned int rgba)
+{
+	for (;*str;str++,x+=charWidth()) {
+		const char *found = strchr(glyphChars, toupper(*str));
+		if (*str == ' ' || found == nullptr)
+			continue;
+		int g = found-glyphChars;
+		float u0 = (float)((g % ATLAS_COLUMNS)*CELL_WIDTH)/ATLAS_WIDTH;
+		float v0 = (float)((g / ATLAS_COLUMNS)*CELL_HEIGHT)/ATLAS_HEIGHT;
+		// The cell is one font pixel bigger than the glyph on every side
+		float pad = (float)GLYPH_SPREAD/GLYPH_TEXELS*HUD_SCALE;
+		quad(x-pad, y-pad, 5*HUD_SCALE+2*pad, 7*HUD_SCALE+2*pad,
+				u0, v0, u0+(float)CELL_WIDTH/ATLAS_WIDTH, v0+(float)CELL_HEIGHT/ATLAS_HEIGHT, rgba);
+	}
+	return x;
+}
+
+void Hud::box(float x, float y, float w, float h, unsigned int rgba)
+{
+	// Middle of the solid glyph is far inside, any point there is opaque
+	float u = ((SOLID_GLYPH % ATLAS_COLUMNS)*CELL_WIDTH+CELL_WIDTH/2+0.5f)/ATLAS_WIDTH;
+	float v = ((SOLID_GLYPH / ATLAS_COLUMNS)*CELL_HEIGHT+CELL_HEIGHT/2+0.5f)/ATLAS_HEIGHT;
+	quad(x, y, w, h, u, v, u, v, rgba);
+}
+
+void Hud::graph(float x, float y, float w, float h, float maxMs)
+{
+	box(x, y, w, h, 0x30303080);
+	float bar = w/HUD_GRAPH_FRAMES;
+	for (int i=0;i<HUD_GRAPH_FRAMES;i++) {
+		float ms = frameTimes[(nextFrame+i) % HUD_GRAPH_FRAMES];
+		float height = std::min(ms/maxMs, 1.0f)*h;
+		// Green within 60 fps, yellow within 30 fps, red above
+		unsigned int color = (ms <= 1000.0f/60) ? 0x40E040FF : (ms <= 1000.0f/30) ? 0xE0E040FF : 0xE04040FF;
+		box(x+i*bar, y+h-height, bar, height, color);
+	}
+	// 60 fps line
+	if (1000.0f/60 < maxMs)
+		box(x, y+h-(1000.0f/60)/maxMs*h, w, 1.0f, 0xFFFFFF80);
+}
+
+void Hud::upload()
+{
+	pending = false;
+	instances = 0;
+	if (quads.size() <= 1)
+		return;
+	float left = quads[1].x, top = quads[1].y, right = left, bottom = top;
+	for (size_t i=1;i<quads.size();i++) {
+		left = std::min(left, quads[i].x);
+		right = std::max(right, quads[i].x+quads[i].w);
+		top = std::min(top, quads[i].y);
+		bottom = std::max(bottom, quads[i].y+quads[i].h);
+	}
+	// The panel goes into the quad begin() kept free, so it is drawn first
+	box(left-2*HUD_SCALE, top-2*HUD_SCALE, right-left+4*HUD_SCALE, bottom-top+4*HUD_SCALE, 0x000000A0);
+	quads.front() = quads.back();
+	quads.pop_back();
+
+	// Orphan the buffer, the GPU may still draw last frame's HUD from it
+	size_t bytes = quads.size()*sizeof(hud_quad);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	if (bytes > vboSize)
+		vboSize = std::max(bytes, 2*vboSize);
+	glBufferData(GL_ARRAY_BUFFER, vboSize, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, quads.data());
+	instances = quads.size();
+}
+
+void Hud::draw()
+{
+	if (pending)
+		upload();
+	if (instances == 0)
+		return;
+	glState.setDepthTest(false);
+	glState.setBlend(true);
+	glState.setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glState.bindVertexArray(vao);
+	glState.bindTexture(0, texture);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instances);
+}
@@ -0,0 +1,70 @@
+#ifndef HUD_H
+#define HUD_H
+
+#include <GL/glew.h>
+#include <vector>
+
+#define HUD_GRAPH_FRAMES 120	// frame times in the graph
+#define HUD_SCALE 2.0f			// screen pixels per font pixel
+#define HUD_REFRESH_MS 250.0f	// numbers and graph are rebuilt this often
+
+// One instance of a 4 vertex triangle strip, the vertex shader makes the corners
+struct hud_quad{
+	GLfloat x, y, w, h;			// pixels from the top-left corner
+	GLfloat u0, v0, u1, v1;
+	GLubyte color[4];
+};
+
+// Overlay with text and a frame time graph, drawn over the finished frame.
+// Glyphs are a built-in 5x7 font turned into a signed distance field atlas once, so
+// they stay sharp at any scale. Panel, graph bars and text are all quads of the same
+// atlas (boxes sample a solid glyph), so the whole HUD is one buffer upload and one
+// instanced draw call. The quads are only rebuilt and uploaded every HUD_REFRESH_MS,
+// the frames in between draw the same buffer again.
+class Hud{
+public:
+	Hud();
+
+	// Must be called with a current GL context
+	void init();
+	void release();
+
+	void toggle() { visible = !visible; sinceRefresh = HUD_REFRESH_MS; }
+	bool isVisible() const { return visible; }
+	// Call it every frame, also while hidden, so the graph is full when it is shown
+	void addFrameTime(float ms);
+	// The quads are older than HUD_REFRESH_MS, begin() and fill them again before draw()
+	bool needsRefresh() const { return sinceRefresh >= HUD_REFRESH_MS; }
+
+	// Start new quads
+	void begin();
+	// Text in upper case, lower case letters are drawn as upper case.
+	// Returns the x after the last character
+	float text(float x, float y, const char *str, unsigned int rgba);
+	void box(float x, float y, float w, float h, unsigned int rgba);
+	// Bars of the last frame times, `maxMs` is the top of the graph
+	void graph(float x, float y, float w, float h, float maxMs);
+	// Draw all quads with a dark panel behind them, uploaded first if begin() was called.
+	// The HUD program must be in use, with screenSize set
+	void draw();
+
+	static float lineHeight() { return 9*HUD_SCALE; }
+	static float charWidth() { return 6*HUD_SCALE; }
+
+private:
+	void buildAtlas();
+	void quad(float x, float y, float w, float h, float u0, float v0, float u1, float v1, unsigned int rgba);
+	void upload();
+
+	GLuint vao, vbo, texture;
+	size_t vboSize;
+	std::vector<hud_quad> quads;	// reused every refresh
+	bool pending;					// quads not uploaded yet
+	GLsizei instances;				// quads in the buffer
+	float frameTimes[HUD_GRAPH_FRAMES];
+	int nextFrame;
+	float sinceRefresh;				// milliseconds since begin()
+	bool visible;
+};
+
+#endif // HUD_H
@@ -0,0 +1,80 @@
+#include "instance_buffer.h"
+#include "gl_state.h"
+#include <cstddef>
+#include <cstring>
+
+size_t InstanceBuffer::add(const instance_data &instance)
+{
+	instances.push_back(instance);
+	return instances.size()-1;
+}
+
+void InstanceBuffer::upload(StreamBuffer &stream)
+{
+	if (instances.empty())
+		return;
+	size_t offset;
+	void *dst = stream.allocate(instances.size()*sizeof(instance_data), sizeof(instance_data), offset);
+	if (dst == nullptr)
+		return;
+	memcpy(dst, instances.data(), instances.size()*sizeof(instance_data));
+	buffer = stream.buffer();
+	generation = stream.generation();
+	base = offset/sizeof(instance_data);
+}
+
+// Point the instance attributes of the bound VAO at instance `first`
+void InstanceBuffer::attach(size_t first)
+{
+	GLsizei stride = sizeof(instance_data);
+	size_t start = first*sizeof(instance_data);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+	// mat4 and mat3 take one location per column
+	for (int c=0;c<4;c++) {
+		GLuint location = INSTANCE_ATTRIB_LOCATION+c;
+		glEnableVertexAttribArray(location);
+		glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, stride,
+				(GLvoid*)(start + offsetof(instance_data, model) + c*sizeof(glm::vec4)));
+		glVertexAttribDivisor(location, 1);
+	}
+	for (int c=0;c<3;c++) {
+		GLuint location = INSTANCE_ATTRIB_LOCATION+4+c;
+		glEnableVertexAttribArray(location);
+		glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, stride,
+				(GLvoid*)(start + offsetof(instance_data, normal) + c*sizeof(glm::vec3)));
+		glVertexAttribDivisor(location, 1);
+	}
+	GLuint location = INSTANCE_ATTRIB_LOCATION+7;
+	glEnableVertexAttribArray(location);
+	glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, stride,
+			(GLvoid*)(start + offsetof(instance_data, ambient)));
+	glVertexAttribDivisor(location, 1);
+}
+
+static bool baseInstance()
+{
+	return GLEW_VERSION_4_2 || GLEW_ARB_base_instance;
+}
+
+void InstanceBuffer::bind(GLuint vao, size_t first)
+{
+	glState.bindVertexArray(vao);
+	if (!baseInstance())
+		attach(base+first);
+	else if (attached[vao] != generation) {
+		attach(0);
+		attached[vao] = generation;
+	}
+}
+
+void InstanceBuffer::draw(GLuint vao, const mesh_range &mesh, size_t first, size_t count)
+{
+	bind(vao, first);
+	const GLvoid *indices = (const GLvoid*)(mesh.firstIndex*sizeof(GLuint));
+	if (baseInstance())
+		glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, indices,
+				count, mesh.baseVertex, base+first);
+	else
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, indices, count, mesh.baseVertex);
+}
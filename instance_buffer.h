@@ -0,0 +1,59 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <map>
+#include "geometry_buffer.h"
+#include "stream_buffer.h"
+
+// First vertex attribute location used by per-instance data (see vsLighting.txt)
+#define INSTANCE_ATTRIB_LOCATION 3
+
+// Per-instance vertex attributes, tightly packed
+struct instance_data{
+	glm::mat4 model;		// locations 3-6
+	glm::mat3 normal;		// locations 7-9, transpose(inverse(mat3(model)))
+	glm::vec3 ambient;		// location 10
+};
+
+// The instance data of every instanced draw of a frame, written into the stream
+// buffer as one array. Draws take consecutive ranges of it. With GL 4.2 (or
+// ARB_base_instance) a range is selected by the base instance, otherwise the
+// attribute pointers of the VAO are moved.
+// The array starts at a multiple of sizeof(instance_data) in the stream buffer, so
+// the attributes always point at offset 0 and base instances just count from there.
+class InstanceBuffer{
+public:
+	InstanceBuffer(): buffer(0), generation(0), base(0) {}
+
+	void clear() { instances.clear(); }
+	void reserve(size_t count) { instances.reserve(count); }
+	// Append an instance, returns its index in the buffer
+	size_t add(const instance_data &instance);
+	size_t size() const { return instances.size(); }
+	instance_data *data() { return instances.data(); }
+	// Stream buffer bytes needed by upload()
+	size_t uploadSize() const { return (instances.size()+1)*sizeof(instance_data); }
+	// Write all instances of this frame into the stream buffer
+	void upload(StreamBuffer &stream);
+	// Instance index of the first instance of this frame in the stream buffer
+	size_t first() const { return base; }
+	// Bind `vao` with its instance attributes starting at instance `first`.
+	// With base instance support they always start at 0 and the draw selects the range
+	void bind(GLuint vao, size_t first);
+	// Draw `count` instances of `mesh` starting at `first` with the bound program and textures
+	void draw(GLuint vao, const mesh_range &mesh, size_t first, size_t count);
+
+private:
+	void attach(size_t first);
+
+	GLuint buffer;						// stream buffer of this frame
+	unsigned int generation;			// of the stream buffer, see StreamBuffer::generation
+	size_t base;
+	std::vector<instance_data> instances;
+	std::map<GLuint, unsigned int> attached;	// VAOs which have the instance attributes, and the generation of their buffer
+};
+
+#endif // INSTANCE_BUFFER_H
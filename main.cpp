@@ -2,17 +2,43 @@
 #include <GLFW/glfw3.h>
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
+#include <deque>
+#include <algorithm>
+#include <chrono>
 #include "tiny_obj_loader.h"
+#include "texture_manager.h"
+#include "program_cache.h"
+#include "shader_compiler.h"
+#include "uniform_table.h"
+#include "uniform_blocks.h"
+#include "transform_stage.h"
+#include "gl_state.h"
+#include "render_queue.h"
+#include "instance_buffer.h"
+#include "geometry_buffer.h"
+#include "stream_buffer.h"
+#include "scene_graph.h"
+#include "object_store.h"
+#include "headless_context.h"
+#include "frame_capture.h"
+#include "frame_benchmark.h"
+#include "gpu_profiler.h"
+#include "cpu_profiler.h"
+#include "hud.h"
+#include "alloc_tracker.h"
+#include "gaussian_blur.h"
+#include "render_graph.h"
+#include "bloom.h"
 
 #define GLM_FORCE_RADIANS
 #define PI 3.1415
-#define e 2.71828
 
 // Pixel should be double in OSX
 // So we will check if this is run on OSX
@@ -22,16 +48,6 @@
 	#define PIXELMULTI 1.0
 #endif
 
-struct object_struct{
-	unsigned int program;
-	unsigned int vao;
-	unsigned int vbo[4];
-	unsigned int texture;
-	glm::mat4 model;
-	glm::vec3 ambient;
-	object_struct(): model(glm::mat4(1.0f)){}
-};
-
 // Vertex attributes for a quad that fills the entire screen in Normalized Device Coordinates.
 GLfloat screenVertices[] = {
         // Positions   // TexCoords
@@ -43,20 +59,133 @@ GLfloat screenVertices[] = {
          1.0f, -1.0f,  1.0f, 0.0f,	//right-bottom
          1.0f,  1.0f,  1.0f, 1.0f	//right-top
 };
-GLuint frameBuffer;
-GLuint texColorBuffer;
+int screenWidth = 800, screenHeight = 600;	// window size, --width and --height
 GLuint screenVAO, screenVBO;
 GLfloat Zoom = 1.5;
 double xpos,ypos;	// Mouse Pos
 double circleArea = 5000.0;
 double stdDev = 0.84089642;		// stdDev for Gaussian Blur
+GaussianBlur lensBlur;				// blurs the part of the scene the lens shows
+RenderGraph renderGraph;			// Passes of a frame and the targets between them
+Bloom bloom;						// glow around the bright parts of the scene
+bool bloomEnabled = false;			// B toggles it, --bloom
+float bloomRadius = 1.0f;			// of the bloom upsampling tent, --bloom-radius
+// How the lens passes run
+enum post_backend{
+	POST_FRAGMENT,		// fragment shaders drawing the rectangles they write
+	POST_COMPUTE		// compute shaders storing images, the blur caches tiles in shared memory (GL 4.3)
+};
+post_backend postBackend = POST_COMPUTE;	// falls back to POST_FRAGMENT without GL 4.3, --post
+const char *postNames[] = {"fragment", "compute"};
 bool playing = true;
 
-std::vector<object_struct> objects;	// VAO: vertex array object,vertex buffer object and texture(color) for objs
-unsigned int FlatProgram, GouraudProgram, PhongProgram, BlinnProgram, ScreenProgram;	// Five shader program
-int sun, earth;						// index in objects
+// Camera and lights, uploaded once per frame in the FrameData uniform block
+const glm::vec3 cameraStart(40.0f, 15.0f, 40.0f);
+glm::vec3 cameraPos = cameraStart;
+glm::mat4 viewProjection;			// set in main when the screen size is known
+std::vector<glm::vec3> lights(1, glm::vec3(0.0f));	// the sun is the only light
+UniformBlocks uniformBlocks;		// Per-frame and per-object uniform data of lighting programs
+RenderQueue renderQueue;			// Draws of a frame sorted by state
+unsigned int programSwitches, textureSwitches, drawCalls;	// in the last frame
+double submitTime;					// CPU milliseconds to build and issue the draws of the last frame
+InstanceBuffer instanceBuffer;		// Per-instance data of instanced draws
+StreamBuffer streamBuffer;			// Ring of per-frame data the GPU reads
+GpuProfiler gpuProfiler;			// GPU time of the passes and draws, --gpu-profile
+bool gpuProfileRequested = false;	// the profiler is on without the HUD
+bool printStats = false;			// counters of the frames on stdout every second, --stats
+Hud hud;							// Performance overlay, H toggles it
+unsigned long long triangleCount;	// in the last frame
+double frameTime;					// milliseconds between the last two frames
+
+// How objects are submitted
+enum submit_mode{
+	SUBMIT_OBJECT,		// one draw call per object with its object block
+	SUBMIT_INSTANCED,	// runs of the same program, texture and mesh become one instanced draw call
+	SUBMIT_INDIRECT		// one glMultiDrawElementsIndirect per program and texture
+};
+submit_mode submitMode = SUBMIT_INDIRECT;	// falls back to SUBMIT_INSTANCED without GL 4.3
+const char *submitNames[] = {"object", "instanced", "indirect"};
+// Objects with the same program, texture and mesh are drawn with one instanced
+// draw call when there are at least this many of them
+#define MIN_INSTANCES 2
+// One draw call of a frame
+struct draw_struct{
+	submit_mode kind;
+	unsigned int program, texture;
+	int mesh;
+	size_t first;		// object block, first instance or first indirect command
+	size_t count;		// number of instances or commands
+};
+std::vector<draw_struct> draws;		// reused every frame
+
+// Stress mode: a belt of small spheres, all of them share one mesh and texture
+#define BELT_SCALE 0.2f
+#define BELT_SLICES 12
+#define BELT_STACKS 8
+int stressCount = 0;
+std::vector<int> beltNodes;			// scene node of every belt body
+std::vector<glm::vec4> belt;		// orbit radius, phase, height and speed of every belt body
+
+ObjectStore objects;				// Mesh, texture(color) and material for objs
+std::vector<uint32_t> visibleObjects;	// dense indices of objects inside the view, reused every frame
+unsigned int FlatProgram, GouraudProgram, PhongProgram, BlinnProgram, ScreenProgram, HudProgram;	// Six shader program
+unsigned int BlurHProgram, BlurVProgram;	// horizontal and vertical pass of lensBlur
+unsigned int BlurHComputeProgram, BlurVComputeProgram, ScreenComputeProgram;	// the lens passes as compute shaders, 0 without GL 4.3
+unsigned int BloomPrefilterProgram, BloomDownProgram, BloomUpProgram, BloomCompositeProgram;	// steps of bloom
+object_handle sun, earth;			// handles in objects
 int ProgramIndex = 2;				// To indicate which program is used now
-std::vector<int> indicesCount;		// Number of indices of objs
+GeometryBuffer geometryBuffer;		// Vertices and indices of all meshes
+SceneGraph sceneGraph;				// Transforms of all objects
+int earthOrbit;						// scene node carrying the earth around the sun
+TextureManager textureManager;		// Keep object textures inside the VRAM budget
+ProgramCache programCache("shader_cache");	// Linked program binaries saved on disk
+bool useProgramCache = true;
+ShaderCompiler shaderCompiler(programCache);	// Build programs in the background
+
+// Headless mode: render a fixed number of frames without a window, for batch runs
+bool headless = false;
+int frameCount = 0;					// stop after this many frames, 0 runs until the window is closed
+bool fixedShading = false;			// --shading given, don't cycle through the shading modes
+std::string outputDir;				// write every frame as a bmp here
+std::string checksumFile;			// write a checksum of every frame here
+HeadlessContext headlessContext;
+FrameCapture frameCapture;
+
+// Benchmark mode: every shading mode and post-processing setting for --frames frames,
+// with the same scripted animation, camera and lens path
+std::string benchmarkFile;			// JSON results are written here
+std::string gpuProfileFile;			// GPU scopes of every frame are written here
+std::string traceFile = "cpu_trace.json";	// CPU scopes are written here by the T key or --trace
+bool traceOnExit = false;
+int traceFrames = 120;				// frames in a trace, 0 for everything still in the buffers
+#define BENCHMARK_FRAMES 300		// frames per case if --frames is not given
+#define BENCHMARK_WARMUP 30			// frames rendered before a case is measured
+int benchmarkRepeats = 3;			// rounds of all cases, --benchmark-repeats
+#define BENCHMARK_MAX_SIGMA 16		// lens blur cases from sigma 1 up to this
+#define BENCHMARK_LENS_AREAS 4
+const int lensAreas[BENCHMARK_LENS_AREAS] = {1000, 5000, 20000, 80000};	// circleArea of the lens size cases
+#define BENCHMARK_BLOOM_RADII 4
+const float bloomRadii[BENCHMARK_BLOOM_RADII] = {0.5f, 1.0f, 2.0f, 4.0f};	// bloomRadius of the bloom cases
+FrameBenchmark frameBenchmark;
+
+// Allocation check: once the first frame is done and every program is built, a frame
+// must not allocate. Frames which do are reported with their call sites and the
+// program exits with a failure
+bool checkAllocations = false;
+
+// Sun rotation, earth rotation and revolution, advanced by a fixed step every frame
+struct animation_struct{
+	float angle, rev, sunAngle;
+};
+const animation_struct animationStart = {5.0f, 5.0f, 5.0f};
+animation_struct animation = animationStart;
+
+// Seconds since the program started, glfwGetTime needs GLFW which headless mode doesn't start
+const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+static double now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now()-startTime).count();
+}
 
 
 static void error_callback(int error, const char* description)
@@ -84,6 +213,24 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
 
 	else if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
 		playing = (playing == true) ? false : true;
+
+	// Press T to write the CPU scopes of the last frames as a Chrome trace
+	else if (key == GLFW_KEY_T && action == GLFW_PRESS)
+		CpuProfiler::writeTrace(traceFile, traceFrames);
+
+	// Press B to turn bloom on or off
+	else if (key == GLFW_KEY_B && action == GLFW_PRESS)
+		bloomEnabled = !bloomEnabled;
+
+	// Press P to run the lens with compute or fragment shaders, if compute shaders are there
+	else if (key == GLFW_KEY_P && action == GLFW_PRESS && ScreenComputeProgram)
+		postBackend = (postBackend == POST_COMPUTE) ? POST_FRAGMENT : POST_COMPUTE;
+
+	// Press H to show or hide the HUD, it needs the GPU profiler for pass timings
+	else if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+		hud.toggle();
+		gpuProfiler.setEnabled(hud.isVisible() || gpuProfileRequested);
+	}
 }
 
 static void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
@@ -93,112 +240,145 @@ static void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 		circleArea = circleArea + 1000*yoffset;
 }
 
-// Setup shader program here
-static unsigned int setup_shader(const char *vertex_shader, const char *fragment_shader)
+static std::string readfile(const char *filename)
 {
-	GLuint vs=glCreateShader(GL_VERTEX_SHADER);
-
-	// bind the source code to VS object
-	glShaderSource(vs, 1, (const GLchar**)&vertex_shader, nullptr);
-
-	// compile the source code of VS object
-	glCompileShader(vs);
-
-	/***** To check if compiling is success or not *****/
-	int status, maxLength;
-	char *infoLog=nullptr;
-	glGetShaderiv(vs, GL_COMPILE_STATUS, &status);	// get status
-	if(status==GL_FALSE)
-	{
-		glGetShaderiv(vs, GL_INFO_LOG_LENGTH, &maxLength);	//get info length
-
-		/* The maxLength includes the NULL character */
-		infoLog = new char[maxLength];
-
-		glGetShaderInfoLog(vs, maxLength, &maxLength, infoLog);	//get info
-
-		fprintf(stderr, "Vertex Shader Error: %s\n", infoLog);
-
-		/* Handle the error in an appropriate way such as displaying a message or writing to a log file. */
-		/* In this simple program, we'll just leave */
-		delete [] infoLog;
-		return 0;
-	}
-	/***************************************************/
-
-	//create a shader object and set shader type to run on a programmable fragment processor
-	GLuint fs=glCreateShader(GL_FRAGMENT_SHADER);
-
-	// bind the source code to FS object
-	glShaderSource(fs, 1, (const GLchar**)&fragment_shader, nullptr);
-
-	// compile the source code of FS object
-	glCompileShader(fs);
-
-	glGetShaderiv(fs, GL_COMPILE_STATUS, &status);	// get compile status
-	if(status==GL_FALSE)
-	{
-		glGetShaderiv(fs, GL_INFO_LOG_LENGTH, &maxLength);	//get info length
-
-		/* The maxLength includes the NULL character */
-		infoLog = new char[maxLength];
-
-		glGetShaderInfoLog(fs, maxLength, &maxLength, infoLog);	//get info
-
-		fprintf(stderr, "Fragment Shader Error: %s\n", infoLog);
+	std::ifstream ifs(filename);
+	if(!ifs)
+		exit(EXIT_FAILURE);
+	return std::string( (std::istreambuf_iterator<char>(ifs)),
+			(std::istreambuf_iterator<char>()));
+}
 
-		/* Handle the error in an appropriate way such as displaying a message or writing to a log file. */
-		/* In this simple program, we'll just leave */
-		delete [] infoLog;
-		return 0;
+// Expand `#include "file"` lines, and put `defines` right below the #version line
+static std::string preprocess(const std::string &source, const std::string &defines)
+{
+	std::string result;
+	size_t begin = 0;
+	while (begin < source.size()) {
+		size_t end = source.find('\n', begin);
+		end = (end == std::string::npos) ? source.size() : end+1;
+		std::string line = source.substr(begin, end-begin);
+		if (line.compare(0, 9, "#include ") == 0) {
+			size_t first = line.find('"'), last = line.rfind('"');
+			result += preprocess(readfile(line.substr(first+1, last-first-1).c_str()), "");
+			result += "\n";
+		}
+		else {
+			result += line;
+			if (line.compare(0, 8, "#version") == 0)
+				result += defines;
+		}
+		begin = end;
 	}
+	return result;
+}
 
-	// Create a program object
-	unsigned int program=glCreateProgram();
-
-	// Attach our shaders to our program
-	glAttachShader(program, vs);
-	glAttachShader(program, fs);
+// A program built from shader files with a set of #define lines
+struct permutation_struct{
+	std::string name;
+	std::string key;		// file names and defines
+	std::string vsFile, fsFile;
+	std::string defines;
+	unsigned int program;
+	unsigned int instanced;	// same program with INSTANCED defined, 0 until it is needed
+};
+std::vector<permutation_struct> permutations;
 
-	// Link the shader in the program
-	glLinkProgram(program);
+// Name of a program built by setup_shader, for profiling
+static const char *programName(unsigned int program)
+{
+	for (size_t i=0;i<permutations.size();i++)
+		if (permutations[i].program == program)
+			return permutations[i].name.c_str();
+	return "program";
+}
 
-	// To check if linking is success or not
-	glGetProgramiv(program, GL_LINK_STATUS, &status);
-	if(status==GL_FALSE)
-	{
-		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &maxLength);
+// Setup shader program here, compiling is started but not waited for.
+// Use shaderCompiler.require() before the program is used.
+// The same files with the same defines are only built once.
+static unsigned int setup_shader(const char *name, const char *vsFile, const char *fsFile, const std::string &defines = "")
+{
+	PROFILE_SCOPE("setup shader");
+	std::string key = std::string(vsFile) + "|" + fsFile + "|" + defines;
+	for (size_t i=0;i<permutations.size();i++)
+		if (permutations[i].key == key)
+			return permutations[i].program;
+
+	permutation_struct permutation;
+	permutation.name = name;
+	permutation.key = key;
+	permutation.vsFile = vsFile;
+	permutation.fsFile = fsFile;
+	permutation.defines = defines;
+	permutation.instanced = 0;
+	permutation.program = shaderCompiler.submit(name, preprocess(readfile(vsFile), defines),
+			preprocess(readfile(fsFile), defines));
+	permutations.push_back(permutation);
+	return permutation.program;
+}
 
-		/* The maxLength includes the NULL character */
-		infoLog = new char[maxLength];
-		glGetProgramInfoLog(program, maxLength, NULL, infoLog);
-		glGetProgramInfoLog(program, maxLength, &maxLength, infoLog);
+// The same for a compute program, its file is kept as fsFile
+static unsigned int setup_compute(const char *name, const char *csFile, const std::string &defines = "")
+{
+	PROFILE_SCOPE("setup shader");
+	std::string key = std::string("|") + csFile + "|" + defines;
+	for (size_t i=0;i<permutations.size();i++)
+		if (permutations[i].key == key)
+			return permutations[i].program;
+
+	permutation_struct permutation;
+	permutation.name = name;
+	permutation.key = key;
+	permutation.fsFile = csFile;
+	permutation.defines = defines;
+	permutation.instanced = 0;
+	permutation.program = shaderCompiler.submitCompute(name, preprocess(readfile(csFile), defines));
+	permutations.push_back(permutation);
+	return permutation.program;
+}
 
-		fprintf(stderr, "Link Error: %s\n", infoLog);
+// Features of the lighting uber-shader (vsLighting.txt, fsLighting.txt and lighting.txt)
+enum lighting_frequency{ LIGHTING_FLAT, LIGHTING_VERTEX, LIGHTING_FRAGMENT };
+struct lighting_features{
+	lighting_frequency frequency;
+	bool blinn;				// Blinn-Phong specular
+	bool texture;
+	int shininess;
+	float specularStrength;
+	int lightCount;
+};
 
-		/* Handle the error in an appropriate way such as displaying a message or writing to a log file. */
-		/* In this simple program, we'll just leave */
-		delete [] infoLog;
-		return 0;
-	}
-	// No more need to be used, delete it
-	glDeleteShader(vs);
-	glDeleteShader(fs);
-	return program;
+// Build the lighting program with these features
+static unsigned int setup_lighting_shader(const char *name, const lighting_features &features)
+{
+	static const char *frequencies[] = {"LIGHTING_FLAT", "LIGHTING_VERTEX", "LIGHTING_FRAGMENT"};
+	char defines[256];
+	snprintf(defines, sizeof(defines), "#define %s\n%s%s#define SHININESS %d.0\n#define SPECULAR_STRENGTH %f\n#define LIGHT_COUNT %d\n",
+			frequencies[features.frequency], features.blinn ? "#define SPECULAR_BLINN\n" : "",
+			features.texture ? "#define USE_TEXTURE\n" : "", features.shininess, features.specularStrength,
+			features.lightCount);
+	return setup_shader(name, "vsLighting.txt", "fsLighting.txt", defines);
 }
 
-static std::string readfile(const char *filename)
+// Show how long each permutation took and its binary size
+static void printPermutations()
 {
-	std::ifstream ifs(filename);
-	if(!ifs)
-		exit(EXIT_FAILURE);
-	return std::string( (std::istreambuf_iterator<char>(ifs)),
-			(std::istreambuf_iterator<char>()));
+	printf("%-10s %-12s %-8s %s\n", "Program", "Build (ms)", "Cached", "Binary (bytes)");
+	for (size_t i=0;i<permutations.size();i++) {
+		unsigned int program = permutations[i].program;
+		GLint length = 0;
+		// Every program is finished here, a failed one is deleted
+		if (shaderCompiler.require(program))
+			glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		printf("%-10s %-12.2f %-8s %d\n", permutations[i].name.c_str(), shaderCompiler.buildTime(program),
+				shaderCompiler.fromCache(program) ? "yes" : "no", length);
+	}
 }
 
 // mini bmp loader written by HSU YOU-LUN
 static unsigned char *load_bmp(const char *bmp, unsigned int *width, unsigned int *height, unsigned short int *bits)
 {
+	PROFILE_SCOPE("load bmp");
 	unsigned char *result=nullptr;
 	FILE *fp = fopen(bmp, "rb");
 	if(!fp)
@@ -233,434 +413,1497 @@ static unsigned char *load_bmp(const char *bmp, unsigned int *width, unsigned in
 	return result;
 }
 
-// Add vertex data and bmp into VBO and setup VAO, then put them into objects array
-static int add_obj(unsigned int program, const char *filename,const char *texbmp)
+// Add vertex data into the geometry buffer and bmp into a texture, then put them into objects array.
+// The object gets a scene node below `parent`
+static object_handle add_mesh(unsigned int program, const tinyobj::mesh_t &mesh, const char *texbmp, int parent = NO_PARENT)
 {
-	object_struct new_node;
+	object_handle handle = objects.add();
+	size_t i = objects.index(handle);
+	objects.nodes()[i] = sceneGraph.add(parent);
+
+	// Vertices and indices are suballocated from the shared buffers
+	objects.meshes()[i] = geometryBuffer.add(mesh);
+
+	// Generate texture objects
+	glGenTextures(1, &objects.textures()[i]);
+	// Texture manager loads it with mipmaps and accounts its VRAM,
+	// and loads it again when it gets levels back after an eviction
+	if(mesh.texcoords.size()>0)
+		textureManager.add(objects.textures()[i], texbmp);
+
+	objects.programs()[i] = program;
+	return handle;
+}
 
+// Load the first shape of an .obj file, see add_mesh
+static object_handle add_obj(unsigned int program, const char *filename,const char *texbmp, int parent = NO_PARENT)
+{
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
 
 	// Load .obj file
+	PROFILE_SCOPE("load obj");
 	std::string err = tinyobj::LoadObj(shapes, materials, filename);
 	if (!err.empty()||shapes.size()==0)
 	{
 		std::cerr<<err<<std::endl;
 		exit(1);
 	}
+	return add_mesh(program, shapes[0].mesh, texbmp, parent);
+}
 
-	// Generate Vertex Array Objects
-	glGenVertexArrays(1, &new_node.vao);
-	glGenBuffers(4, new_node.vbo);
-
-	// Generate texture objects
-	glGenTextures(1, &new_node.texture);
-
-	// Start VAO recording
-	glBindVertexArray(new_node.vao);
-
-	// Upload postion array
-	glBindBuffer(GL_ARRAY_BUFFER, new_node.vbo[0]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*shapes[0].mesh.positions.size(),
-			shapes[0].mesh.positions.data(), GL_STATIC_DRAW);
-
-	// Put into vs's input (location=0)
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-	if(shapes[0].mesh.texcoords.size()>0)
-	{
-		// Upload texCoord array
-		glBindBuffer(GL_ARRAY_BUFFER, new_node.vbo[1]);		// bind buffer type
-		// copy data into buffers
-		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*shapes[0].mesh.texcoords.size(),
-				shapes[0].mesh.texcoords.data(), GL_STATIC_DRAW);
-
-		// Put into vs's input (location=1)
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glBindTexture( GL_TEXTURE_2D, new_node.texture);
-		unsigned int width, height;
-		unsigned short int bits;
-		unsigned char *bgr=load_bmp(texbmp, &width, &height, &bits);
-		GLenum format = (bits == 24? GL_BGR: GL_BGRA);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, format, GL_UNSIGNED_BYTE, bgr);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
-		glGenerateMipmap(GL_TEXTURE_2D);
-		delete [] bgr;
+// Add a unit sphere with `slices` x `stacks` segments, see add_mesh
+static object_handle add_sphere(unsigned int program, int slices, int stacks, const char *texbmp, int parent = NO_PARENT)
+{
+	tinyobj::mesh_t mesh;
+	for (int y=0;y<=stacks;y++) {
+		float v = (float)y/stacks;
+		for (int x=0;x<=slices;x++) {
+			float u = (float)x/slices;
+			glm::vec3 p(sin(PI*v)*sin(2*PI*u), cos(PI*v), sin(PI*v)*cos(2*PI*u));
+			mesh.positions.insert(mesh.positions.end(), &p[0], &p[0]+3);
+			mesh.normals.insert(mesh.normals.end(), &p[0], &p[0]+3);
+			mesh.texcoords.push_back(u);
+			mesh.texcoords.push_back(1.0f-v);
+		}
 	}
-
-	if(shapes[0].mesh.normals.size()>0)
-	{
-		// Upload normal array
-		glBindBuffer(GL_ARRAY_BUFFER, new_node.vbo[2]);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*shapes[0].mesh.normals.size(),
-				shapes[0].mesh.normals.data(), GL_STATIC_DRAW);
-
-		// Put into vs's input (location=2)
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	for (int y=0;y<stacks;y++) {
+		for (int x=0;x<slices;x++) {
+			unsigned int a = y*(slices+1)+x, b = a+slices+1;
+			unsigned int quad[6] = {a, b, a+1, a+1, b, b+1};
+			mesh.indices.insert(mesh.indices.end(), quad, quad+6);
+		}
 	}
+	return add_mesh(program, mesh, texbmp, parent);
+}
 
-	// Setup index buffer for glDrawElements
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, new_node.vbo[3]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*shapes[0].mesh.indices.size(),
-			shapes[0].mesh.indices.data(), GL_STATIC_DRAW);
+// Add an object drawing the mesh and texture of `source`, the texture stays owned by `source`.
+// It gets its own scene node below `parent`
+static object_handle add_shared_obj(object_handle source, int parent = NO_PARENT)
+{
+	object_handle handle = objects.add();
+	size_t i = objects.index(handle), from = objects.index(source);
+	objects.programs()[i] = objects.programs()[from];
+	objects.textures()[i] = objects.textures()[from];
+	objects.meshes()[i] = objects.meshes()[from];
+	objects.ambients()[i] = objects.ambients()[from];
+	objects.nodes()[i] = sceneGraph.add(parent);
+	objects.shared()[i] = 1;
+	return handle;
+}
 
-	indicesCount.push_back(shapes[0].mesh.indices.size());
+// Put the belt bodies on their orbits at revolution `rev`
+static void moveBelt(float rev)
+{
+	for (size_t i=0;i<belt.size();i++) {
+		float a = belt[i].y + rev*belt[i].w;
+		sceneGraph.setTranslation(beltNodes[i], glm::vec3(belt[i].x*sin(a), belt[i].z, belt[i].x*cos(a)));
+	}
+}
 
-	// End of VAO recording
-	glBindVertexArray(0);
+// Put the sun, earth and belt where `animation` says
+static void animate()
+{
+	sceneGraph.setTranslation(earthOrbit, glm::vec3(8.0*sin(animation.rev),3.0*sin(animation.rev),16.0*cos(animation.rev)));
+	sceneGraph.setRotation(objects.nodes()[objects.index(earth)], glm::angleAxis(animation.angle, glm::normalize(glm::vec3(0.1f, 1.0f, 0.0f))));
+	sceneGraph.setRotation(objects.nodes()[objects.index(sun)], glm::angleAxis(animation.sunAngle, glm::vec3(0.0f, 1.0f, 0.0f)));
+	moveBelt(animation.rev);
+}
 
-	new_node.program = program;
+// Do the next step for sun rotation, earth rotation and revolution
+static void stepAnimation()
+{
+	PROFILE_SCOPE("animation");
+	animation.angle = animation.angle + 0.1f;
+	animation.sunAngle = animation.sunAngle + 0.003f;
+	animation.rev = animation.rev + 0.01f;
+	animate();
+}
 
-	objects.push_back(new_node);
-	return objects.size()-1;
+// View-projection of the camera at cameraPos looking at the sun
+static void updateCamera()
+{
+	viewProjection = glm::perspective(glm::radians(24.0f), (float)screenWidth/screenHeight, 1.0f, 100.f)*
+			glm::lookAt(cameraPos, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 }
 
-// This function will initialize all works before using framebuffer
-static void frameBuffer_init()
+// Quad the post processing passes draw
+static void screenQuad_init()
 {
 	glGenVertexArrays(1, &screenVAO);
 	glGenBuffers(1, &screenVBO);
-	glBindVertexArray(screenVAO);
+	glState.bindVertexArray(screenVAO);
 	glBindBuffer(GL_ARRAY_BUFFER, screenVBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(screenVertices), &screenVertices, GL_STATIC_DRAW);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4*sizeof(GLfloat), (GLvoid*)0);
 	glEnableVertexAttribArray(1);
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4*sizeof(GLfloat), (GLvoid*)(2*sizeof(GLfloat)));
-	glBindVertexArray(0);
-
-	glGenFramebuffers(1, &frameBuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
-
-	// Generate texture buffer and bind it to framebuffer
-	glGenTextures(1, &texColorBuffer);
-	glBindTexture(GL_TEXTURE_2D, texColorBuffer);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 800*PIXELMULTI, 600*PIXELMULTI, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texColorBuffer, 0);
-
-	// Generate render buffer and bind it to framebuffer
-	GLuint rbo;
-	glGenRenderbuffers(1, &rbo);
-	glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, 800*PIXELMULTI, 600*PIXELMULTI);
-	glBindRenderbuffer(GL_RENDERBUFFER, 0);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbo);
-
-	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-		std::cout << "FrameBuffer is not complete!!!" << std::endl;
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glState.bindVertexArray(0);
 }
 
 // Free all objects and memory space
 static void releaseObjects()
 {
-	for(int i=0;i<objects.size();i++){
-		glDeleteVertexArrays(1, &objects[i].vao);
-		glDeleteTextures(1, &objects[i].texture);
-		glDeleteBuffers(4, objects[i].vbo);
+	textureManager.clear();
+	for(size_t i=0;i<objects.size();i++){
+		if (objects.shared()[i])
+			continue;
+		glDeleteTextures(1, &objects.textures()[i]);
+		glState.deletedTexture(objects.textures()[i]);
 	}
+	geometryBuffer.release();
 	// Delete all the program
 	glDeleteProgram(FlatProgram);
 	glDeleteProgram(GouraudProgram);
 	glDeleteProgram(PhongProgram);
 	glDeleteProgram(BlinnProgram);
 	glDeleteProgram(ScreenProgram);
+	glDeleteProgram(HudProgram);
+	glDeleteProgram(BlurHProgram);
+	glDeleteProgram(BlurVProgram);
+	glDeleteProgram(BlurHComputeProgram);
+	glDeleteProgram(BlurVComputeProgram);
+	glDeleteProgram(ScreenComputeProgram);
+	glDeleteProgram(BloomPrefilterProgram);
+	glDeleteProgram(BloomDownProgram);
+	glDeleteProgram(BloomUpProgram);
+	glDeleteProgram(BloomCompositeProgram);
+	for (size_t i=0;i<permutations.size();i++)
+		if (permutations[i].instanced)
+			glDeleteProgram(permutations[i].instanced);
+	streamBuffer.release();
+	gpuProfiler.release();
+	hud.release();
+	lensBlur.release();
+	bloom.release();
+	renderGraph.release();
+}
+
+// The key function of HW2, you can change Uniform variable here.
+// Every program gets a table of its uniforms and typed handles to them, built once
+// after the program is linked, so no location is looked up while rendering.
+// A handle of a uniform which the program doesn't have is invalid and setting it does nothing.
+// Lighting programs get their data from uniform blocks instead (see uniform_blocks.h).
+struct program_uniforms{
+	UniformTable table;
+	// Screen program
+	uniform_handle<float> Zoom, pixelMulti, circleArea;
+	uniform_handle<int> blurSampler;
+	uniform_handle<glm::vec2> mouseLoc, screenSize;
+};
+// One entry per program ever used. A deque grows without moving the entries, so the
+// references getUniforms returns stay valid; it only grows when a program is first used
+std::deque<program_uniforms> programUniforms;
+
+// Return the uniforms of `program`, reflect them first if it is a new program
+static program_uniforms &getUniforms(unsigned int program)
+{
+	for (size_t i=0;i<programUniforms.size();i++)
+		if (programUniforms[i].table.owner() == program)
+			return programUniforms[i];
+
+	programUniforms.push_back(program_uniforms());
+	program_uniforms &u = programUniforms.back();
+	u.table.reflect(program);
+	UniformBlocks::bindProgram(program);
+	GaussianBlur::bindProgram(program);
+	Bloom::bindProgram(program);
+	u.Zoom = u.table.handle<float>("Zoom");
+	u.pixelMulti = u.table.handle<float>("pixelMulti");
+	u.circleArea = u.table.handle<float>("circleArea");
+	u.blurSampler = u.table.handle<int>("blurSampler");
+	u.mouseLoc = u.table.handle<glm::vec2>("mouseLoc");
+	u.screenSize = u.table.handle<glm::vec2>("screenSize");
+	return u;
 }
 
-// This function will return mat3 sample gauss matrix with given sigma
-static glm::mat3 buildGaussianMat3()
+// Return the instanced variant of a lighting program, building it the first time.
+// Returns 0 if `program` has no variant or it failed to build
+static unsigned int instancedProgram(unsigned int program)
 {
-	double element[9] = {0};
-	double sumArg = 0.0;
-	for (int i=-1;i<=1;i++)
-	{
-		for (int j=-1;j<=1;j++)
-		{
-			double arg = 1/(2*PI*stdDev*stdDev)*pow(e, -(i*i+j*j)/(2*stdDev*stdDev));
-			element[3*i+j+4] = arg;
-			sumArg = sumArg + arg;
+	for (size_t i=0;i<permutations.size();i++) {
+		if (permutations[i].program != program)
+			continue;
+		if (permutations[i].instanced == 0 && permutations[i].vsFile == "vsLighting.txt") {
+			// setup_shader adds to permutations, so don't hold a reference
+			unsigned int instanced = setup_shader((permutations[i].name+"Inst").c_str(), permutations[i].vsFile.c_str(),
+					permutations[i].fsFile.c_str(), permutations[i].defines + "#define INSTANCED\n");
+			instanced = shaderCompiler.require(instanced);
+			if (instanced)
+				getUniforms(instanced);
+			permutations[i].instanced = instanced;
 		}
+		return permutations[i].instanced;
 	}
-	// Normalize
-	for (int k=0;k<9;k++)
-		element[k] = element[k] / sumArg;
+	return 0;
+}
 
-	return glm::make_mat3(element);
+// Fill the HUD with the numbers of the last frame
+static void fillHud(const RenderGraph &graph)
+{
+	// Counted before the HUD changes anything
+	const gl_state_stats &state = glState.stats();
+	unsigned int stateIssued = state.issued, stateFiltered = state.filtered;
+
+	char line[128];
+	float x = 12.0f, y = 12.0f;
+	hud.begin();
+	snprintf(line, sizeof(line), "FRAME %.2f MS  %.1f FPS", frameTime, frameTime > 0.0 ? 1000.0/frameTime : 0.0);
+	hud.text(x, y, line, 0xFFFFFFFF);
+	y += Hud::lineHeight();
+	hud.graph(x, y, 2.0f*HUD_GRAPH_FRAMES, 40.0f, 50.0f);
+	y += 40.0f + Hud::lineHeight()/2;
+
+	// GPU passes, averaged by the profiler. Draw groups after the first few are left out
+	const std::vector<gpu_scope_result> &scopes = gpuProfiler.lastFrame();
+	int groups = 0;
+	for (size_t i=0;i<scopes.size();i++) {
+		if (strncmp(scopes[i].name, "draw ", 5) == 0 && groups++ >= 4)
+			continue;
+		snprintf(line, sizeof(line), "GPU %*s%s %.3f MS", 2*scopes[i].depth, "", scopes[i].name,
+				gpuProfiler.average(scopes[i].name));
+		hud.text(x, y, line, 0xA0E0FFFF);
+		y += Hud::lineHeight();
+	}
+	snprintf(line, sizeof(line), "CPU SUBMIT %.3f MS", submitTime);
+	hud.text(x, y, line, 0xFFFFFFFF);
+	y += Hud::lineHeight();
+	snprintf(line, sizeof(line), "DRAWS %u  TRIANGLES %llu", drawCalls, triangleCount);
+	hud.text(x, y, line, 0xFFFFFFFF);
+	y += Hud::lineHeight();
+	snprintf(line, sizeof(line), "STATE CHANGES %u  FILTERED %u", stateIssued, stateFiltered);
+	hud.text(x, y, line, 0xFFFFFFFF);
+	y += Hud::lineHeight();
+	snprintf(line, sizeof(line), "VRAM TEXTURES %.1f MB  TARGETS %.1f MB  BUFFERS %.1f MB",
+			textureManager.stats().usedBytes/1048576.0, graph.stats().pooledBytes/1048576.0,
+			(geometryBuffer.bytes()+streamBuffer.bytes())/1048576.0);
+	hud.text(x, y, line, 0xFFFFFFFF);
 }
 
-// The key function of HW2, you can change Uniform variable here
-static void setUniformMat4(unsigned int program, const std::string &name, const glm::mat4 &mat)
+// Draw the HUD, filled again when its numbers are older than HUD_REFRESH_MS
+static void drawHud(RenderGraph &graph, void *user)
 {
-	// This line can be ignore. But, if you have multiple shader program
-	// You must check if currect binding is the one you want
-	glUseProgram(program);
-	GLint loc=glGetUniformLocation(program, name.c_str());
-	if(loc==-1) return;
+	unsigned int program = shaderCompiler.require(HudProgram);
+	if (program == 0)
+		return;
+	if (hud.needsRefresh())
+		fillHud(graph);
+
+	glState.useProgram(program);
+	program_uniforms &uniforms = getUniforms(program);
+	uniforms.table.set(uniforms.screenSize, glm::vec2(screenWidth, screenHeight));
+	hud.draw();
+}
+
+// Targets of a frame, declared by the stages below
+struct frame_targets{
+	rg_resource window;			// the default framebuffer
+	rg_resource scene, sceneDepth;
+	rg_resource bloomDown[BLOOM_MAX_LEVELS+1], bloomUp[BLOOM_MAX_LEVELS+1];	// by level, 1 is half the size
+	rg_resource bloomed;		// the scene with bloom, only where the lens reads it
+	rg_resource shown;			// what the lens stage shows, the scene after post processing
+	rg_resource lensRows;		// it around the lens blurred along rows
+	rg_resource lens;			// and then along columns
+	rg_resource lensZoom;		// the square around the lens, by the compute backend
+};
+frame_targets targets;
+
+// Pixels [x0, x1) x [y0, y1) of a target
+struct pixel_rect{
+	int x0, y0, x1, y1;
+};
+pixel_rect lensSquare;		// of the window around the lens circle, empty without a lens
+pixel_rect lensSource;		// of the scene the lens shows, blurred
+pixel_rect bloomRect;		// of bloomed, the lens square and what the lens blur reads
 
-	// mat4 of glm is column major, same as opengl
-	// we don't need to transpose it. so..GL_FALSE
-	// Put `mat` into uniform variable in vs.txt
-	glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(mat));
+// One step of the bloom chain, the user data of its pass
+struct bloom_step{
+	unsigned int program;
+	rg_resource source;			// the level filtered
+	rg_resource add;			// the down chain level added going up, the scene for the composite
+};
+bloom_step bloomSteps[2*BLOOM_MAX_LEVELS];
+bloom_step *compositeStep;	// bloom of the frame for the lens stage to add, nullptr without bloom
+const char *bloomDownNames[BLOOM_MAX_LEVELS] = {"bloom down 1", "bloom down 2", "bloom down 3", "bloom down 4", "bloom down 5", "bloom down 6"};
+const char *bloomUpNames[BLOOM_MAX_LEVELS] = {"bloom up 1", "bloom up 2", "bloom up 3", "bloom up 4", "bloom up 5", "bloom up 6"};
+
+/********* Scene *********/
+static void drawScene(RenderGraph &graph, void *user)
+{
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glState.setDepthTest(true);
+	glState.setBlendFunc(GL_ONE, GL_ZERO);
+	textureManager.beginFrame();
+
+	// Camera and lights of the frame
+	frame_block &frame = uniformBlocks.frame();
+	frame.vp = viewProjection;
+	frame.viewPos = glm::vec4(cameraPos, 1.0f);
+	frame.lightCount = std::min((int)lights.size(), MAX_LIGHTS);
+	for (int i=0;i<frame.lightCount;i++)
+		frame.lightPos[i] = glm::vec4(lights[i], 1.0f);
+
+	// World matrices of everything that moved since the last frame
+	sceneGraph.update();
+
+	// Every pass below only reads the object arrays it needs
+	const unsigned int *programs = objects.programs(), *textures = objects.textures();
+	const int *meshes = objects.meshes(), *nodes = objects.nodes();
+	const glm::vec3 *ambients = objects.ambients();
+	glm::vec4 *bounds = objects.bounds();
+
+	// Bounding spheres in world space, then drop the objects outside the view
+	for(size_t i=0;i<objects.size();i++){
+		const glm::mat4 &world = sceneGraph.world(nodes[i]);
+		const glm::vec4 &local = geometryBuffer.mesh(meshes[i]).bounds;
+		float scale = std::max(glm::length(glm::vec3(world[0])), std::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+		bounds[i] = glm::vec4(glm::vec3(world*glm::vec4(glm::vec3(local), 1.0f)), local.w*scale);
+	}
+	cull_objects(viewProjection, bounds, objects.size(), visibleObjects);
+
+	// Sort the draws, so objects sharing program, texture and mesh are next to each other
+	renderQueue.clear();
+	for(size_t v=0;v<visibleObjects.size();v++){
+		uint32_t i = visibleObjects[v];
+		float depth = glm::distance(cameraPos, glm::vec3(bounds[i])) / 100.0f;
+		renderQueue.push(PASS_OPAQUE, programs[i], textures[i], meshes[i], depth, i);
+	}
+	renderQueue.sort();
+
+	// Runs of the same program, texture and mesh are drawn instanced, either with
+	// their own draw call or as one command of a multi-draw. Every other object gets
+	// its own object block
+	double submitStart = now();
+	draws.clear();
+	triangleCount = 0;
+	instanceBuffer.clear();
+	geometryBuffer.clearCommands();
+	size_t blockCount = 0;
+	for(size_t n=0;n<renderQueue.size();){
+		uint32_t first = renderQueue[n].object;
+		size_t end = n+1;
+		while (end < renderQueue.size()) {
+			uint32_t next = renderQueue[end].object;
+			if (programs[next] != programs[first] || textures[next] != textures[first] || meshes[next] != meshes[first])
+				break;
+			end++;
+		}
+
+		draw_struct draw;
+		draw.texture = textures[first];
+		draw.mesh = meshes[first];
+		triangleCount += geometryBuffer.mesh(draw.mesh).indexCount/3*(end-n);
+		unsigned int instanced = 0;
+		if (submitMode == SUBMIT_INDIRECT || (submitMode == SUBMIT_INSTANCED && end-n >= MIN_INSTANCES))
+			instanced = instancedProgram(programs[first]);
+		if (instanced) {
+			if (submitMode == SUBMIT_INDIRECT) {
+				// Extend the multi-draw of the last run if the state is the same
+				draw_struct *last = draws.empty() ? nullptr : &draws.back();
+				if (last && last->kind == SUBMIT_INDIRECT && last->program == instanced && last->texture == draw.texture)
+					last->count++;
+				else {
+					draw.kind = SUBMIT_INDIRECT;
+					draw.program = instanced;
+					draw.first = geometryBuffer.commandCount();
+					draw.count = 1;
+					draws.push_back(draw);
+				}
+				geometryBuffer.addCommand(draw.mesh, instanceBuffer.size(), end-n);
+			}
+			else {
+				draw.kind = SUBMIT_INSTANCED;
+				draw.program = instanced;
+				draw.first = instanceBuffer.size();
+				draw.count = end-n;
+				draws.push_back(draw);
+			}
+			for (;n<end;n++) {
+				instance_data instance;
+				instance.model = sceneGraph.world(nodes[renderQueue[n].object]);
+				instance.ambient = ambients[renderQueue[n].object];
+				instanceBuffer.add(instance);
+			}
+			continue;
+		}
+		for (;n<end;n++) {
+			int i = renderQueue[n].object;
+			object_block &block = uniformBlocks.object(blockCount);
+			block.model = sceneGraph.world(nodes[i]);
+			block.ambientLight = glm::vec4(ambients[i], 1.0f);
+			draw.kind = SUBMIT_OBJECT;
+			draw.program = programs[i];
+			draw.first = blockCount++;
+			draw.count = 1;
+			draws.push_back(draw);
+		}
+	}
+
+	// Uniform blocks, instances and commands are written into this frame's region
+	// of the stream buffer, it waits here if the GPU is still reading the region
+	streamBuffer.beginFrame(uniformBlocks.uploadSize(blockCount) + instanceBuffer.uploadSize() +
+			geometryBuffer.commandsSize());
+	transform_objects(viewProjection, uniformBlocks.objectArray(), blockCount);
+	uniformBlocks.upload(blockCount, streamBuffer);
+	transform_instances(instanceBuffer.data(), instanceBuffer.size());
+	instanceBuffer.upload(streamBuffer);
+	geometryBuffer.uploadCommands(streamBuffer, instanceBuffer.first());
+	streamBuffer.commit();
+
+	programSwitches = textureSwitches = 0;
+	unsigned int lastProgram = 0, lastTexture = 0;
+	for(size_t n=0;n<draws.size();n++){
+		const draw_struct &draw = draws[n];
+		if (draw.program != lastProgram)
+			programSwitches++;
+		if (draw.texture != lastTexture)
+			textureSwitches++;
+		lastProgram = draw.program;
+		lastTexture = draw.texture;
+
+		// Every draw group is a scope of its own
+		if (gpuProfiler.isEnabled()) {
+			char name[64];
+			snprintf(name, sizeof(name), "draw %zu %s %s", n, programName(draw.program), submitNames[draw.kind]);
+			gpuProfiler.begin(name);
+		}
+
+		glState.useProgram(draw.program);
+		textureManager.use(draw.texture);	// levels back if the budget has room
+		glState.bindTexture(0, draw.texture);
+
+		const mesh_range &mesh = geometryBuffer.mesh(draw.mesh);
+		switch (draw.kind) {
+			case SUBMIT_OBJECT:
+				// Model matrix and ambient strength are in the object block
+				glState.bindVertexArray(geometryBuffer.vao());
+				uniformBlocks.bindObject(draw.first);
+				glDrawElementsBaseVertex(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT,
+						(GLvoid*)(mesh.firstIndex*sizeof(GLuint)), mesh.baseVertex);
+				break;
+			case SUBMIT_INSTANCED:
+				instanceBuffer.draw(geometryBuffer.vao(), mesh, draw.first, draw.count);
+				break;
+			case SUBMIT_INDIRECT:
+				instanceBuffer.bind(geometryBuffer.vao(), 0);
+				geometryBuffer.multiDraw(draw.first, draw.count);
+				break;
+		}
+		gpuProfiler.end();
+	}
+	streamBuffer.endFrame();
+	submitTime = (now()-submitStart)*1000.0;
+	drawCalls = draws.size();
+	textureManager.enforce();	// evict textures not drawn recently if we are over budget
+}
+/*************************/
+
+/********* Bloom *********/
+static void bloomDownsample(RenderGraph &graph, void *user)
+{
+	const bloom_step &step = *(const bloom_step*)user;
+	bloom.downsample(step.program, screenVAO, graph.texture(step.source));
+}
+
+static void bloomUpsample(RenderGraph &graph, void *user)
+{
+	const bloom_step &step = *(const bloom_step*)user;
+	bloom.upsample(step.program, screenVAO, graph.texture(step.source), graph.texture(step.add));
+}
+
+/*************************/
+
+/********* Lens: blur the part of the scene it shows, then draw it over a copy of the scene *********/
+static void blurLensRows(RenderGraph &graph, void *user)
+{
+	// The vertical pass reads `radius` rows above and below the rectangle
+	lensBlur.pass(BlurHProgram, screenVAO, graph.texture(targets.shown), lensSource.x0, std::max(lensSource.y0-lensBlur.radius(), 0),
+			lensSource.x1, std::min(lensSource.y1+lensBlur.radius(), graph.height(targets.shown)));
+}
+
+static void blurLensColumns(RenderGraph &graph, void *user)
+{
+	lensBlur.pass(BlurVProgram, screenVAO, graph.texture(targets.lensRows), lensSource.x0, lensSource.y0, lensSource.x1, lensSource.y1);
+}
+
+// The square around the lens circle is left to the lens passes, so the bands
+// above, below, left and right of it are drawn and every pixel is written once
+static void sceneBands(RenderGraph &graph, int bands[4][4])
+{
+	int width = graph.width(targets.window), height = graph.height(targets.window);
+	const pixel_rect &s = lensSquare;
+	int b[4][4] = {{0, 0, width, s.y0}, {0, s.y1, width, height}, {0, s.y0, s.x0, s.y1}, {s.x1, s.y0, width, s.y1}};
+	memcpy(bands, b, sizeof(b));
+}
+
+// Outside the lens the scene is shown as it is, no shader needed for that
+static void copyScene(RenderGraph &graph, void *user)
+{
+	int bands[4][4];
+	sceneBands(graph, bands);
+	glState.bindFramebuffers(0, graph.framebuffer(targets.shown));
+	for (int i=0;i<4;i++) {
+		const int *b = bands[i];
+		if (b[0] < b[2] && b[1] < b[3])
+			glBlitFramebuffer(b[0], b[1], b[2], b[3], b[0], b[1], b[2], b[3], GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+}
+
+// With bloom the bands are drawn by fsBloomComposite.txt instead, which adds it on the way
+static void compositeScene(RenderGraph &graph, void *user)
+{
+	const bloom_step &step = *(const bloom_step*)user;
+	int bands[4][4];
+	sceneBands(graph, bands);
+	for (int i=0;i<4;i++) {
+		const int *b = bands[i];
+		if (b[0] < b[2] && b[1] < b[3]) {
+			glViewport(b[0], b[1], b[2]-b[0], b[3]-b[1]);
+			bloom.composite(step.program, screenVAO, graph.texture(step.add), graph.texture(step.source));
+		}
+	}
+}
+
+// and into bloomed over bloomRect, for the lens passes to read
+static void compositeLens(RenderGraph &graph, void *user)
+{
+	const bloom_step &step = *(const bloom_step*)user;
+	const pixel_rect &r = bloomRect;
+	glViewport(r.x0, r.y0, r.x1-r.x0, r.y1-r.y0);
+	bloom.composite(step.program, screenVAO, graph.texture(step.add), graph.texture(step.source));
+}
+
+// Zoom, size and place of the lens, in use by fsScreen.txt or csScreen.txt
+static void setLensUniforms(unsigned int program)
+{
+	glState.useProgram(program);
+	program_uniforms &screen = getUniforms(program);
+	screen.table.set(screen.Zoom, Zoom);
+	screen.table.set(screen.pixelMulti, PIXELMULTI);
+	screen.table.set(screen.screenSize, glm::vec2(screenWidth, screenHeight));
+	screen.table.set(screen.circleArea, circleArea);
+	screen.table.set(screen.blurSampler, 1);
+	screen.table.set(screen.mouseLoc, glm::vec2(xpos,std::abs(screenHeight-ypos)));
+}
+
+// The viewport is the square, fsScreen.txt shows the scene as it is at the corners
+static void drawLens(RenderGraph &graph, void *user)
+{
+	glViewport(lensSquare.x0, lensSquare.y0, lensSquare.x1-lensSquare.x0, lensSquare.y1-lensSquare.y0);
+	glState.bindVertexArray(screenVAO);
+	glState.setDepthTest(false);
+	glState.bindTexture(0, graph.texture(targets.shown));
+	glState.bindTexture(1, graph.texture(targets.lens));
+	setLensUniforms(ScreenProgram);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
 }
 
-static void setUniformMat3(unsigned int program, const std::string &name, const glm::mat3 &mat)
+// Compute backend: the same passes store images, only the lens square is left to copy
+static void dispatchLensRows(RenderGraph &graph, void *user)
 {
-	// This line can be ignore. But, if you have multiple shader program
-	// You must check if currect binding is the one you want
-	glUseProgram(program);
-	GLint loc=glGetUniformLocation(program, name.c_str());
-	if(loc==-1) return;
+	lensBlur.dispatch(BlurHComputeProgram, graph.texture(targets.shown), graph.texture(targets.lensRows), true, lensSource.x0,
+			std::max(lensSource.y0-lensBlur.radius(), 0), lensSource.x1, std::min(lensSource.y1+lensBlur.radius(), graph.height(targets.shown)));
+}
 
-	// mat4 of glm is column major, same as opengl
-	// we don't need to transpose it. so..GL_FALSE
-	// Put `mat` into uniform variable in vs.txt
-	glUniformMatrix3fv(loc, 1, GL_FALSE, glm::value_ptr(mat));
+static void dispatchLensColumns(RenderGraph &graph, void *user)
+{
+	lensBlur.dispatch(BlurVComputeProgram, graph.texture(targets.lensRows), graph.texture(targets.lens), false,
+			lensSource.x0, lensSource.y0, lensSource.x1, lensSource.y1);
 }
 
-// A function which is similar to setUniformMat4, but this time it is for vec3
-static void setUniformVec3(unsigned int program, const std::string &name, const glm::vec3 &vector)
+// csScreen.txt over the square, 16x16 pixels per work group
+static void dispatchLens(RenderGraph &graph, void *user)
 {
-	// This line can be ignore. But, if you have multiple shader program
-	// You must check if currect binding is the one you want
-	glUseProgram(program);
-	GLint loc=glGetUniformLocation(program, name.c_str());
-	if(loc==-1) return;
+	const pixel_rect &s = lensSquare;
+	glState.bindTexture(0, graph.texture(targets.shown));
+	glState.bindTexture(1, graph.texture(targets.lens));
+	glBindImageTexture(0, graph.texture(targets.lensZoom), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+	setLensUniforms(ScreenComputeProgram);
+	// Locations are fixed in csScreen.txt
+	glUniform2i(0, s.x0, s.y0);
+	glUniform2i(1, s.x1, s.y1);
+	glDispatchCompute((s.x1-s.x0+15)/16, (s.y1-s.y0+15)/16, 1);
+}
 
-	glUniform3f(loc, vector.x, vector.y, vector.z);
+static void copyLens(RenderGraph &graph, void *user)
+{
+	const pixel_rect &s = lensSquare;
+	glState.bindFramebuffers(0, graph.framebuffer(targets.lensZoom));
+	glBlitFramebuffer(s.x0, s.y0, s.x1, s.y1, s.x0, s.y0, s.x1, s.y1, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+}
+/***************************************************************************************************/
+
+// A stage adds its passes to the graph of the frame. It gets the color the stage
+// before it produced and returns the color it produces, the last one is the window
+typedef rg_resource (*frame_stage)(RenderGraph &graph, rg_resource color);
+
+static bool bloomActive(int width, int height)
+{
+	return bloomEnabled && Bloom::levels(width, height) > 0;
 }
 
-static void setUniformVec2(unsigned int program, const std::string &name, const glm::vec2 &vector)
+static rg_resource addScenePasses(RenderGraph &graph, rg_resource color)
 {
-	// This line can be ignore. But, if you have multiple shader program
-	// You must check if currect binding is the one you want
-	glUseProgram(program);
-	GLint loc=glGetUniformLocation(program, name.c_str());
-	if(loc==-1) return;
+	int width = screenWidth*PIXELMULTI, height = screenHeight*PIXELMULTI;
+	// Bloom needs what is brighter than 1, so the scene keeps it in half floats then
+	targets.scene = graph.create("scene", width, height, bloomActive(width, height) ? GL_RGBA16F : GL_RGB8);
+	targets.sceneDepth = graph.create("scene depth", width, height, GL_DEPTH24_STENCIL8);
+	int pass = graph.addPass("scene", drawScene, nullptr);
+	graph.write(pass, targets.scene);
+	graph.write(pass, targets.sceneDepth);
+	return targets.scene;
+}
 
-	glUniform2f(loc, vector.x, vector.y);
+// Down the chain from the scene and back up. Every step is a pass of its own, so each
+// level is timed, and the group times all of them. The result is added to the scene by
+// the lens stage, in the passes drawing the window, so there is no full size copy
+static rg_resource addBloomPasses(RenderGraph &graph, rg_resource color)
+{
+	int width = graph.width(color), height = graph.height(color);
+	compositeStep = nullptr;
+	if (!bloomActive(width, height))
+		return color;
+	int levels = Bloom::levels(width, height);
+	graph.beginGroup("bloom");
+	bloom_step *step = bloomSteps;
+	rg_resource above = color;
+	for (int k=1;k<=levels;k++) {
+		// Levels are blurry anyway, R11F_G11F_B10F moves half the bytes of half floats
+		targets.bloomDown[k] = graph.create(bloomDownNames[k-1], width>>k, height>>k, GL_R11F_G11F_B10F);
+		step->program = (k == 1) ? BloomPrefilterProgram : BloomDownProgram;
+		step->source = above;
+		step->add = RG_NONE;
+		int pass = graph.addPass(bloomDownNames[k-1], bloomDownsample, step++);
+		graph.read(pass, above);
+		graph.write(pass, targets.bloomDown[k]);
+		above = targets.bloomDown[k];
+	}
+	rg_resource below = above;
+	for (int k=levels-1;k>=1;k--) {
+		targets.bloomUp[k] = graph.create(bloomUpNames[k-1], width>>k, height>>k, GL_R11F_G11F_B10F);
+		step->program = BloomUpProgram;
+		step->source = below;
+		step->add = targets.bloomDown[k];
+		int pass = graph.addPass(bloomUpNames[k-1], bloomUpsample, step++);
+		graph.read(pass, below);
+		graph.read(pass, targets.bloomDown[k]);
+		graph.write(pass, targets.bloomUp[k]);
+		below = targets.bloomUp[k];
+	}
+	graph.endGroup();
+	step->program = BloomCompositeProgram;
+	step->source = below;
+	step->add = color;
+	compositeStep = step;
+	return color;
 }
 
-// A function which is similar to setUniformMat4, but this time it is for vec3
-static void setUniformFloat(unsigned int program, const std::string &name, const GLfloat &value)
+// The blur passes are always added, they are culled when no lens pass reads them
+static rg_resource addLensPasses(RenderGraph &graph, rg_resource color)
 {
-	// This line can be ignore. But, if you have multiple shader program
-	// You must check if currect binding is the one you want
-	glUseProgram(program);
-	GLint loc=glGetUniformLocation(program, name.c_str());
-	if(loc==-1) return;
+	targets.shown = color;
+	int width = graph.width(color), height = graph.height(color);
+	float lensRadius = sqrt(circleArea);
+	float x = xpos*PIXELMULTI, y = std::abs(screenHeight-ypos)*PIXELMULTI;
+	pixel_rect &s = lensSquare;
+	s.x0 = std::max((int)floor(x-lensRadius), 0);
+	s.y0 = std::max((int)floor(y-lensRadius), 0);
+	s.x1 = std::min((int)ceil(x+lensRadius), width);
+	s.y1 = std::min((int)ceil(y+lensRadius), height);
+	bool lens = circleArea > 0.0 && s.x0 < s.x1 && s.y0 < s.y1;
+	if (!lens)
+		s.x0 = s.x1 = s.y0 = s.y1 = 0;
+
+	// A lens pixel at distance d from the mouse shows the scene at distance d/Zoom,
+	// and bilinear filtering reads one more pixel
+	float sourceRadius = lensRadius/Zoom + 2.0f;
+	lensSource.x0 = std::max((int)floor(x-sourceRadius), 0);
+	lensSource.y0 = std::max((int)floor(y-sourceRadius), 0);
+	lensSource.x1 = std::min((int)ceil(x+sourceRadius), width);
+	lensSource.y1 = std::min((int)ceil(y+sourceRadius), height);
+	lensBlur.setSigma(stdDev);
+
+	// The lens reads the scene with bloom over the square and what its blur reads,
+	// which is `radius` texels around the source and one more for bilinear filtering
+	if (compositeStep && lens) {
+		int reach = lensBlur.radius()+1;
+		pixel_rect &r = bloomRect;
+		r.x0 = std::max(std::min(s.x0, lensSource.x0-reach), 0);
+		r.y0 = std::max(std::min(s.y0, lensSource.y0-reach), 0);
+		r.x1 = std::min(std::max(s.x1, lensSource.x1+reach), width);
+		r.y1 = std::min(std::max(s.y1, lensSource.y1+reach), height);
+		targets.bloomed = graph.create("bloomed", width, height, GL_RGB8);
+		int pass = graph.addPass("bloom lens", compositeLens, compositeStep);
+		graph.read(pass, compositeStep->add);
+		graph.read(pass, compositeStep->source);
+		graph.write(pass, targets.bloomed);
+		targets.shown = targets.bloomed;
+	}
 
-	glUniform1f(loc, value);
+	// There is no RGB8 image format, compute shaders store RGBA8
+	bool compute = (postBackend == POST_COMPUTE);
+	GLenum format = compute ? GL_RGBA8 : GL_RGB8;
+	targets.lensRows = graph.create("lens rows", width, height, format);
+	targets.lens = graph.create("lens", width, height, format);
+	if (compute) {
+		int pass = graph.addPass("lens blur h", dispatchLensRows, nullptr);
+		graph.read(pass, targets.shown);
+		graph.store(pass, targets.lensRows);
+		pass = graph.addPass("lens blur v", dispatchLensColumns, nullptr);
+		graph.read(pass, targets.lensRows);
+		graph.store(pass, targets.lens);
+	}
+	else {
+		int pass = graph.addPass("lens blur h", blurLensRows, nullptr);
+		graph.read(pass, targets.shown);
+		graph.write(pass, targets.lensRows);
+		pass = graph.addPass("lens blur v", blurLensColumns, nullptr);
+		graph.read(pass, targets.lensRows);
+		graph.write(pass, targets.lens);
+	}
+
+	int pass;
+	if (compositeStep) {
+		pass = graph.addPass("bloom composite", compositeScene, compositeStep);
+		graph.read(pass, compositeStep->add);
+		graph.read(pass, compositeStep->source);
+	}
+	else {
+		pass = graph.addPass("screen copy", copyScene, nullptr);
+		graph.read(pass, color);
+	}
+	graph.write(pass, targets.window);
+	if (lens && compute) {
+		targets.lensZoom = graph.create("lens zoom", width, height, GL_RGBA8);
+		pass = graph.addPass("lens zoom", dispatchLens, nullptr);
+		graph.read(pass, targets.shown);
+		graph.read(pass, targets.lens);
+		graph.store(pass, targets.lensZoom);
+		pass = graph.addPass("screen lens", copyLens, nullptr);
+		graph.read(pass, targets.lensZoom);
+		graph.write(pass, targets.window);
+	}
+	else if (lens) {
+		pass = graph.addPass("screen lens", drawLens, nullptr);
+		graph.read(pass, targets.shown);
+		graph.read(pass, targets.lens);
+		graph.write(pass, targets.window);
+	}
+	return targets.window;
 }
 
+static rg_resource addHudPasses(RenderGraph &graph, rg_resource color)
+{
+	if (hud.isVisible())
+		graph.write(graph.addPass("hud", drawHud, nullptr), color);
+	return color;
+}
+
+// Stages in the order they draw. Post processing of the whole scene, like bloom
+// or tone mapping, goes between the scene and the lens. Bloom only makes its chain
+// there, the lens stage adds it where it draws the scene
+const frame_stage frameStages[] = {addScenePasses, addBloomPasses, addLensPasses, addHudPasses};
+
 // Draw Object on window
 static void render()
 {
-	/********* 1. Switch to framebuffer first and draw *********/
-	glViewport(0.0, 0.0, 800*PIXELMULTI, 600*PIXELMULTI);
-	glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glEnable(GL_DEPTH_TEST);
-	for(int i=0;i<objects.size();i++){		// draw every object
-		glUseProgram(objects[i].program);
-		glBindVertexArray(objects[i].vao);
-		glBindTexture(GL_TEXTURE_2D, objects[i].texture);
-
-        // I change the model matrix and ambient strength here
-		setUniformMat4(objects[i].program, "model", objects[i].model);
-		setUniformVec3(objects[i].program, "ambientLight", objects[i].ambient);
-		glDrawElements(GL_TRIANGLES, indicesCount[i], GL_UNSIGNED_INT, nullptr);
-	}
-	glBindVertexArray(0);
-	/**********************************************************/
-
-	/********* 2. Switch back to default and clear buffer *********/
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT);
-	/**************************************************************/
-
-	/********* 3. Use screen shader to do post processing *********/
-	glUseProgram(ScreenProgram);
-	glBindVertexArray(screenVAO);
-	glDisable(GL_DEPTH_TEST);
-	glBindTexture(GL_TEXTURE_2D, texColorBuffer);
-	setUniformFloat(ScreenProgram, "Zoom", Zoom);
-	setUniformFloat(ScreenProgram, "pixelMulti", PIXELMULTI);
-	setUniformFloat(ScreenProgram, "circleArea", circleArea);
-	setUniformMat3(ScreenProgram, "gaussMat", buildGaussianMat3());
-	setUniformVec2(ScreenProgram, "mouseLoc", glm::vec2(xpos,std::abs(600-ypos)));
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-	glBindVertexArray(0);
-	/**************************************************************/
+	PROFILE_SCOPE("render");
+	gpuProfiler.beginFrame();
+	gpuProfiler.begin("frame");
+	renderGraph.reset();
+	targets.window = renderGraph.import("window", 0, screenWidth*PIXELMULTI, screenHeight*PIXELMULTI);
+	rg_resource color = RG_NONE;
+	for (size_t i=0;i<sizeof(frameStages)/sizeof(frameStages[0]);i++)
+		color = frameStages[i](renderGraph, color);
+	renderGraph.output(targets.window);
+	renderGraph.execute(&gpuProfiler);
+	gpuProfiler.end();
+	gpuProfiler.endFrame();
+}
 
+// Containers filled by render() are sized for every object being visible as a draw
+// of its own, so no frame has to grow them. Call it when objects were added
+static void reserveFrameData()
+{
+	size_t count = objects.size();
+	visibleObjects.reserve(count);
+	renderQueue.reserve(count);
+	draws.reserve(count);
+	instanceBuffer.reserve(count);
+	geometryBuffer.reserveCommands(count);
+	uniformBlocks.reserve(count);
 }
 
 // This function can change the shading program one after another
 static void changeProgram()
 {
+	PROFILE_SCOPE("changeProgram");
+	unsigned int program = 0;
 	switch(ProgramIndex) {
 		case 1:	// change to Gouraud
-			objects[sun].program = GouraudProgram;
-			objects[earth].program = GouraudProgram;
+			program = GouraudProgram;
 			std::cout << "Gouraud Shading!!!" << std::endl;
 			ProgramIndex = 2;
 			break;
 		case 2:	// change to Phong
-			objects[sun].program = PhongProgram;
-			objects[earth].program = PhongProgram;
+			program = PhongProgram;
 			std::cout << "Phong Shading!!!" << std::endl;
 			ProgramIndex = 3;
 			break;
 		case 3:	// change to Blinn
-			objects[sun].program = BlinnProgram;
-			objects[earth].program = BlinnProgram;
+			program = BlinnProgram;
 			std::cout << "Blinn-Phong Shading!!!" << std::endl;
 			ProgramIndex = 4;
 			break;
 		case 4:	// change to Flat
-			objects[sun].program = FlatProgram;
-			objects[earth].program = FlatProgram;
+			program = FlatProgram;
 			std::cout << "Flat Shading!!!" << std::endl;
 			ProgramIndex = 1;
 			break;
 	}
-	// Since we change the program, we have to set uniform again
-	// Setup the MVP matrix for Sun
-	setUniformMat4(objects[sun].program, "vp", glm::perspective(glm::radians(35.0f), 800.0f/600, 1.0f, 100.f)*
-			glm::lookAt(glm::vec3(40.0f, 15.0f, 40.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f))*glm::mat4(1.0f));
+	// Wait here if this program is still being compiled.
+	// If it failed, the objects keep the program they have, the next change moves on
+	if (shaderCompiler.require(program) == 0) {
+		std::cout << "Shading program is not available, keeping the previous one" << std::endl;
+		return;
+	}
+	for (size_t i=0;i<objects.size();i++)
+		objects.programs()[i] = program;
+	// Nothing is uploaded, camera and lights are already in the uniform buffer
+	// and getUniforms connects the uniform blocks the first time
+	getUniforms(program);
+	// and the instanced variant is built here rather than in the middle of render()
+	if (!belt.empty() || submitMode == SUBMIT_INDIRECT)
+		instancedProgram(program);
+}
 
-	// Setup VP matrix for Earth
-	setUniformMat4(objects[earth].program, "vp", glm::perspective(glm::radians(24.0f), 800.0f/600, 1.0f, 100.f)*
-			glm::lookAt(glm::vec3(40.0f, 15.0f, 40.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f))*glm::mat4(1.0f));
+// Show the frame and handle window events
+static void present(GLFWwindow *window)
+{
+	PROFILE_SCOPE("present");
+	if (headless)
+		headlessContext.swapBuffers();
+	else {
+		{
+			PROFILE_SCOPE("swap buffers");
+			glfwSwapBuffers(window);	// To swap the color buffer in this game loop
+		}
+		PROFILE_SCOPE("poll events");
+		glfwPollEvents();			// To check if any events are triggered
+	}
+}
 
-	// setup lightPos
-	setUniformVec3(objects[earth].program, "lightPos", glm::vec3(0.0f));
-	setUniformVec3(objects[sun].program, "lightPos", glm::vec3(0.0f));
+// One benchmark case: the animation starts over, the camera circles the sun once
+// and the lens moves along a figure eight
+static void benchmarkCase(GLFWwindow *window, const char *shading, const char *post, int frames)
+{
+	animation = animationStart;
+	animate();
+	frameBenchmark.beginCase(shading, post);
+	for (int f=-BENCHMARK_WARMUP;f<frames;f++) {
+		float t = (float)std::max(f, 0)/frames;
+		cameraPos = glm::vec3(cameraStart.x*cos(2*PI*t) + cameraStart.z*sin(2*PI*t), cameraStart.y,
+				cameraStart.z*cos(2*PI*t) - cameraStart.x*sin(2*PI*t));
+		updateCamera();
+		xpos = screenWidth*(0.5 + 0.3*sin(2*PI*t));
+		ypos = screenHeight*(0.5 + 0.3*sin(4*PI*t));
+
+		PROFILE_FRAME();
+		frameBenchmark.beginFrame();
+		glState.beginFrame();
+		render();
+		present(window);
+		frameBenchmark.endFrame(f >= 0);
+		stepAnimation();
+	}
+	frameBenchmark.endCase();
+}
+
+// Settings of one benchmark case
+struct benchmark_setting{
+	int shading;			// index into the shadings of runBenchmark
+	char post[32];
+	double circleArea, stdDev;
+	bool bloom;
+	float bloomRadius;
+	post_backend backend;
+};
 
-	// setup viewPos
-	setUniformVec3(objects[earth].program, "viewPos", glm::vec3(40.0f, 15.0f, 40.0f));
-	setUniformVec3(objects[sun].program, "viewPos", glm::vec3(40.0f, 15.0f, 40.0f));
+// Render every shading mode with and without the lens, then the lens with Phong
+// shading, the blur sigma from 1 to BENCHMARK_MAX_SIGMA, the lens areas of
+// lensAreas, both lens backends at the default and the largest lens and sigma,
+// the bloom radii of bloomRadii and no bloom, the same frames each time.
+// All cases run once per round and there are benchmarkRepeats rounds, so a slow
+// phase of the machine hits every case alike, and the spread of the rounds shows
+// whether a case can be trusted (see FrameBenchmark).
+// Frame times are written to benchmarkFile
+static void runBenchmark(GLFWwindow *window)
+{
+	const char *shadings[] = {"flat", "gouraud", "phong", "blinn"};
+	const int programIndices[] = {4, 1, 2, 3};		// changeProgram moves on to the mode after ProgramIndex
+	int frames = (frameCount > 0) ? frameCount : BENCHMARK_FRAMES;
+
+	std::vector<benchmark_setting> settings;
+	const benchmark_setting lens = {2, "lens", circleArea, stdDev, bloomEnabled, bloomRadius, postBackend};
+	benchmark_setting c;
+	for (int s=0;s<4;s++) {
+		c = lens;
+		c.shading = s;
+		settings.push_back(c);
+		snprintf(c.post, sizeof(c.post), "none");
+		c.circleArea = 0.0;
+		settings.push_back(c);
+	}
+	for (int i=1;i<=BENCHMARK_MAX_SIGMA;i++) {
+		c = lens;
+		snprintf(c.post, sizeof(c.post), "lens sigma %d", i);
+		c.stdDev = i;
+		settings.push_back(c);
+	}
+	// Cost of the lens with its size, same shading
+	for (int i=0;i<BENCHMARK_LENS_AREAS;i++) {
+		c = lens;
+		snprintf(c.post, sizeof(c.post), "lens area %d", lensAreas[i]);
+		c.circleArea = lensAreas[i];
+		settings.push_back(c);
+	}
+	// Fragment and compute shaders for the same lens, compute only with GL 4.3
+	for (int b=POST_FRAGMENT;b<=POST_COMPUTE;b++) {
+		if (b == POST_COMPUTE && ScreenComputeProgram == 0)
+			continue;
+		c = lens;
+		c.backend = (post_backend)b;
+		snprintf(c.post, sizeof(c.post), "lens %s", postNames[b]);
+		settings.push_back(c);
+		snprintf(c.post, sizeof(c.post), "lens %s large", postNames[b]);
+		c.circleArea = lensAreas[BENCHMARK_LENS_AREAS-1];
+		c.stdDev = BENCHMARK_MAX_SIGMA;
+		settings.push_back(c);
+	}
+	// Cost of bloom with its radius, which should not change it
+	for (int i=0;i<BENCHMARK_BLOOM_RADII;i++) {
+		c = lens;
+		snprintf(c.post, sizeof(c.post), "bloom radius %g", bloomRadii[i]);
+		c.bloom = true;
+		c.bloomRadius = bloomRadii[i];
+		settings.push_back(c);
+	}
+	c = lens;
+	snprintf(c.post, sizeof(c.post), "no bloom");
+	c.bloom = false;
+	settings.push_back(c);
+
+	frameBenchmark.init();
+	int shading = -1;
+	for (int r=0;r<benchmarkRepeats;r++) {
+		for (size_t i=0;i<settings.size();i++) {
+			const benchmark_setting &setting = settings[i];
+			if (setting.shading != shading) {
+				ProgramIndex = programIndices[setting.shading];
+				changeProgram();
+				shading = setting.shading;
+			}
+			circleArea = setting.circleArea;
+			stdDev = setting.stdDev;
+			bloomEnabled = setting.bloom;
+			bloom.setRadius(setting.bloomRadius);
+			postBackend = setting.backend;
+			benchmarkCase(window, shadings[setting.shading], setting.post, frames);
+		}
+	}
+	circleArea = lens.circleArea;
+	stdDev = lens.stdDev;
+	bloomEnabled = lens.bloom;
+	bloom.setRadius(lens.bloomRadius);
+	postBackend = lens.backend;
+	cameraPos = cameraStart;
+	updateCamera();
+
+	char value[256];
+	snprintf(value, sizeof(value), "\"%s\"", (const char*)glGetString(GL_RENDERER));
+	frameBenchmark.addInfo("renderer", value);
+	snprintf(value, sizeof(value), "%d", screenWidth);
+	frameBenchmark.addInfo("width", value);
+	snprintf(value, sizeof(value), "%d", screenHeight);
+	frameBenchmark.addInfo("height", value);
+	snprintf(value, sizeof(value), "%d", (int)objects.size());
+	frameBenchmark.addInfo("objects", value);
+	snprintf(value, sizeof(value), "\"%s\"", submitNames[submitMode]);
+	frameBenchmark.addInfo("submit", value);
+	snprintf(value, sizeof(value), "\"%s\"", postNames[postBackend]);
+	frameBenchmark.addInfo("post", value);
+	snprintf(value, sizeof(value), "%d", frames);
+	frameBenchmark.addInfo("frames", value);
+	snprintf(value, sizeof(value), "%d", BENCHMARK_WARMUP);
+	frameBenchmark.addInfo("warmup", value);
+	snprintf(value, sizeof(value), "%d", benchmarkRepeats);
+	frameBenchmark.addInfo("repeats", value);
+	frameBenchmark.print();
+	if (frameBenchmark.writeJson(benchmarkFile))
+		std::cout << "Benchmark written to " << benchmarkFile << std::endl;
+	frameBenchmark.release();
 }
 
 int main(int argc, char *argv[])
 {
-	GLFWwindow* window;
-	glfwSetErrorCallback(error_callback);
-	if (!glfwInit())
-		exit(EXIT_FAILURE);
-	// OpenGL 3.3, Mac OS X is reported to have some problem. However I don't have Mac to test
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-	glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
-	// For Mac OS X
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);	//to make OpenGL forward compatible
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	window = glfwCreateWindow(800, 600, "Solar System", NULL, NULL);	//create a window object
-	if (!window)
-	{
-		glfwTerminate();
-		return EXIT_FAILURE;
+	// Parse command line options
+	for (int i=1;i<argc;i++) {
+		std::string arg = argv[i];
+		if (arg == "--texture-budget" && i+1 < argc)		// VRAM budget for textures in MB
+			textureManager.setBudget(strtoull(argv[++i], nullptr, 10)*1024*1024);
+		else if (arg == "--no-shader-cache")				// always compile shaders from source
+			useProgramCache = false;
+		else if (arg == "--bloom")							// start with bloom turned on
+			bloomEnabled = true;
+		else if (arg == "--no-bloom")						// start with bloom turned off, the default
+			bloomEnabled = false;
+		else if (arg == "--bloom-radius" && i+1 < argc)	// radius of the bloom upsampling tent in texels
+			bloomRadius = atof(argv[++i]);
+		else if (arg == "--post" && i+1 < argc)			// lens passes with fragment or compute shaders
+			postBackend = (std::string(argv[++i]) == "fragment") ? POST_FRAGMENT : POST_COMPUTE;
+		else if (arg == "--stress" && i+1 < argc)			// add a belt of N instanced bodies
+			stressCount = atoi(argv[++i]);
+		else if (arg == "--submit" && i+1 < argc) {		// object, instanced or indirect
+			std::string mode = argv[++i];
+			submitMode = (mode == "object") ? SUBMIT_OBJECT : (mode == "instanced") ? SUBMIT_INSTANCED : SUBMIT_INDIRECT;
+		}
+		else if (arg == "--bench" && i+1 < argc) {			// run a CPU benchmark and leave
+			std::string name = argv[++i];
+			if (name == "render-queue")
+				benchmark_render_queue();
+			else if (name == "scenegraph")
+				benchmark_scene_graph();
+			else if (name == "objects")
+				benchmark_object_store();
+			else if (name == "profiler")
+				benchmark_cpu_profiler();
+			else
+				std::cerr << "Unknown benchmark: " << name << std::endl;
+			return EXIT_SUCCESS;
+		}
+		else if (arg == "--headless")						// no window, render --frames frames and leave
+			headless = true;
+		else if (arg == "--frames" && i+1 < argc)			// number of frames to render
+			frameCount = atoi(argv[++i]);
+		else if (arg == "--width" && i+1 < argc)
+			screenWidth = std::max(atoi(argv[++i]), 1);
+		else if (arg == "--height" && i+1 < argc)
+			screenHeight = std::max(atoi(argv[++i]), 1);
+		else if (arg == "--shading" && i+1 < argc) {		// flat, gouraud, phong or blinn for the whole run
+			// changeProgram moves on to the mode after ProgramIndex
+			std::string mode = argv[++i];
+			ProgramIndex = (mode == "flat") ? 4 : (mode == "gouraud") ? 1 : (mode == "blinn") ? 3 : 2;
+			fixedShading = true;
+		}
+		else if (arg == "--output" && i+1 < argc)			// directory for frame bmps
+			outputDir = argv[++i];
+		else if (arg == "--checksums" && i+1 < argc)		// file for frame checksums
+			checksumFile = argv[++i];
+		else if (arg == "--benchmark" && i+1 < argc)		// measure frame times, write JSON and leave
+			benchmarkFile = argv[++i];
+		else if (arg == "--benchmark-repeats" && i+1 < argc)	// rounds of all cases
+			benchmarkRepeats = std::max(atoi(argv[++i]), 1);
+		else if (arg == "--gpu-profile")					// print GPU time of passes and draws
+			gpuProfileRequested = true;
+		else if (arg == "--stats")							// print uploads, state changes and render graph counters
+			printStats = true;
+		else if (arg == "--hud")							// start with the HUD shown
+			hud.toggle();
+		else if (arg == "--gpu-profile-export" && i+1 < argc)	// and write them to a CSV file
+			gpuProfileFile = argv[++i];
+		else if (arg == "--trace" && i+1 < argc) {			// write a CPU trace when leaving
+			traceFile = argv[++i];
+			traceOnExit = true;
+		}
+		else if (arg == "--trace-frames" && i+1 < argc)
+			traceFrames = atoi(argv[++i]);
+		else if (arg == "--check-allocations")			// fail if a steady-state frame allocates
+			checkAllocations = true;
+	}
+	// Benchmarks and headless runs are reproducible, so the shading mode doesn't change with time
+	if (!benchmarkFile.empty())
+		fixedShading = true;
+	else if (headless) {
+		fixedShading = true;
+		if (frameCount <= 0)
+			frameCount = 1;
 	}
+	updateCamera();
+
+	GLFWwindow* window = nullptr;
+	if (headless) {
+		if (!headlessContext.init(screenWidth*PIXELMULTI, screenHeight*PIXELMULTI))
+			return EXIT_FAILURE;
+		// The lens stays in the middle of the screen
+		xpos = screenWidth/2.0;
+		ypos = screenHeight/2.0;
+	}
+	else {
+		glfwSetErrorCallback(error_callback);
+		if (!glfwInit())
+			exit(EXIT_FAILURE);
+		// OpenGL 3.3, Mac OS X is reported to have some problem. However I don't have Mac to test
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+		// For Mac OS X
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);	//to make OpenGL forward compatible
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		window = glfwCreateWindow(screenWidth, screenHeight, "Solar System", NULL, NULL);	//create a window object
+		if (!window)
+		{
+			glfwTerminate();
+			return EXIT_FAILURE;
+		}
 
-	// Make our window context the main context on current thread
-	glfwMakeContextCurrent(window);
+		// Make our window context the main context on current thread
+		glfwMakeContextCurrent(window);
+	}
 
-	// This line MUST put below glfwMakeContextCurrent or it will crash
+	// This line MUST put below glfwMakeContextCurrent (or headlessContext.init) or it will crash
 	// Set GL_TRUE so that glew will use modern techniques to manage OpenGL functionality
 	glewExperimental = GL_TRUE;
 	glewInit();
 
-	// Enable vsync
-	glfwSwapInterval(1);
+	if (!headless) {
+		// Enable vsync, but not in stress mode or a benchmark where we want to see the frame time
+		glfwSwapInterval((stressCount > 0 || !benchmarkFile.empty()) ? 0 : 1);
 
-	// Setup input callback
-	glfwSetKeyCallback(window, key_callback);
-	glfwSetScrollCallback(window, scroll_callback);
+		// Setup input callback
+		glfwSetKeyCallback(window, key_callback);
+		glfwSetScrollCallback(window, scroll_callback);
+	}
 
-	// setup all shader program
-	FlatProgram = setup_shader(readfile("vsFlat.txt").c_str(), readfile("fsFlat.txt").c_str());
-	GouraudProgram = setup_shader(readfile("vsGouraud.txt").c_str(), readfile("fsGouraud.txt").c_str());
-	PhongProgram = setup_shader(readfile("vs.txt").c_str(), readfile("fs.txt").c_str());
-	BlinnProgram = setup_shader(readfile("vsBlinn.txt").c_str(), readfile("fsBlinn.txt").c_str());
-	ScreenProgram = setup_shader(readfile("vsScreen.txt").c_str(), readfile("fsScreen.txt").c_str());
+	// setup all shader program, from the binary cache if it is possible
+	if (useProgramCache && !programCache.init())
+		std::cout << "Program binary is not supported, shader cache disabled" << std::endl;
+	shaderCompiler.init();
+	if (shaderCompiler.parallel())
+		std::cout << "Parallel shader compile is used" << std::endl;
+	// All of them are submitted first, so the driver can work on them together.
+	// Lighting programs are permutations of one uber-shader
+	int lightCount = std::min((int)lights.size(), MAX_LIGHTS);
+	lighting_features flat = {LIGHTING_FLAT, false, true, 16, 0.8f, lightCount};
+	lighting_features gouraud = {LIGHTING_VERTEX, false, true, 16, 0.8f, lightCount};
+	lighting_features phong = {LIGHTING_FRAGMENT, false, true, 16, 0.8f, lightCount};
+	lighting_features blinn = {LIGHTING_FRAGMENT, true, true, 16, 0.8f, lightCount};
+	FlatProgram = setup_lighting_shader("Flat", flat);
+	GouraudProgram = setup_lighting_shader("Gouraud", gouraud);
+	PhongProgram = setup_lighting_shader("Phong", phong);
+	BlinnProgram = setup_lighting_shader("Blinn", blinn);
+	ScreenProgram = setup_shader("Screen", "vsScreen.txt", "fsScreen.txt");
+	char blurDefines[160];
+	snprintf(blurDefines, sizeof(blurDefines), "#define HORIZONTAL\n#define BLUR_MAX_TAPS %d\n", BLUR_MAX_TAPS);
+	BlurHProgram = setup_shader("BlurH", "vsScreen.txt", "fsBlur.txt", blurDefines);
+	snprintf(blurDefines, sizeof(blurDefines), "#define VERTICAL\n#define BLUR_MAX_TAPS %d\n", BLUR_MAX_TAPS);
+	BlurVProgram = setup_shader("BlurV", "vsScreen.txt", "fsBlur.txt", blurDefines);
+	// The compute backend is built whenever it can run, so it can be switched to and benchmarked
+	if (GLEW_VERSION_4_3) {
+		const char *axes[] = {"HORIZONTAL", "VERTICAL"};
+		unsigned int *programs[] = {&BlurHComputeProgram, &BlurVComputeProgram};
+		for (int i=0;i<2;i++) {
+			snprintf(blurDefines, sizeof(blurDefines), "#define %s\n#define BLUR_MAX_TAPS %d\n#define BLUR_MAX_RADIUS %d\n"
+					"#define BLUR_TILE %d\n#define BLUR_LINES %d\n", axes[i], BLUR_MAX_TAPS, BLUR_MAX_RADIUS, BLUR_TILE, BLUR_LINES);
+			*programs[i] = setup_compute(i == 0 ? "BlurHCompute" : "BlurVCompute", "csBlur.txt", blurDefines);
+		}
+		ScreenComputeProgram = setup_compute("ScreenCompute", "csScreen.txt");
+	}
+	// Screen and blur programs are needed by the first frame, the others are waited in changeProgram
+	ScreenProgram = shaderCompiler.require(ScreenProgram);
+	BlurHProgram = shaderCompiler.require(BlurHProgram);
+	BlurVProgram = shaderCompiler.require(BlurVProgram);
+	BlurHComputeProgram = shaderCompiler.require(BlurHComputeProgram);
+	BlurVComputeProgram = shaderCompiler.require(BlurVComputeProgram);
+	ScreenComputeProgram = shaderCompiler.require(ScreenComputeProgram);
+	// Blur programs only need their kernel block connected
+	getUniforms(BlurHProgram);
+	getUniforms(BlurVProgram);
+	if (BlurHComputeProgram && BlurVComputeProgram && ScreenComputeProgram) {
+		getUniforms(BlurHComputeProgram);
+		getUniforms(BlurVComputeProgram);
+	}
+	else {
+		if (postBackend == POST_COMPUTE)
+			std::cout << "Compute shaders are not supported, the lens uses fragment shaders" << std::endl;
+		postBackend = POST_FRAGMENT;
+		ScreenComputeProgram = 0;
+	}
+	BloomPrefilterProgram = setup_shader("BloomPrefilter", "vsScreen.txt", "fsBloomDown.txt", "#define PREFILTER\n");
+	BloomDownProgram = setup_shader("BloomDown", "vsScreen.txt", "fsBloomDown.txt");
+	BloomUpProgram = setup_shader("BloomUp", "vsScreen.txt", "fsBloomUp.txt");
+	BloomCompositeProgram = setup_shader("BloomComposite", "vsScreen.txt", "fsBloomComposite.txt");
+	// Bloom programs only need their params block and samplers connected
+	unsigned int *bloomPrograms[] = {&BloomPrefilterProgram, &BloomDownProgram, &BloomUpProgram, &BloomCompositeProgram};
+	for (int i=0;i<4;i++) {
+		*bloomPrograms[i] = shaderCompiler.require(*bloomPrograms[i]);
+		getUniforms(*bloomPrograms[i]);
+	}
+	HudProgram = setup_shader("Hud", "vsHud.txt", "fsHud.txt");
 
-	// Build obj and return the index in objects array
-	sun = add_obj(PhongProgram, "sun.obj","sun.bmp");
-	earth = add_obj(PhongProgram, "earth.obj","earth.bmp");
+	// All meshes go into one vertex and one index buffer
+	geometryBuffer.init();
+	if (submitMode == SUBMIT_INDIRECT && !GeometryBuffer::indirectSupported()) {
+		std::cout << "Multi-draw indirect is not supported, instanced draws are used" << std::endl;
+		submitMode = SUBMIT_INSTANCED;
+	}
+
+	textureManager.setLoader(load_bmp);
+
+	// Objects start with Phong shading, or the first mode which builds if it doesn't.
+	// changeProgram keeps this one when the mode it changes to doesn't build
+	unsigned int *lightingPrograms[] = {&PhongProgram, &FlatProgram, &GouraudProgram, &BlinnProgram};
+	unsigned int startProgram = 0;
+	for (int i=0;i<4 && startProgram == 0;i++)
+		startProgram = shaderCompiler.require(*lightingPrograms[i]);
+	if (startProgram == 0) {
+		std::cout << "No shading program builds" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// Build obj and return its handle in objects.
+	// The earth spins below a node which moves it along its orbit
+	sun = add_obj(startProgram, "sun.obj","sun.bmp");
+	earthOrbit = sceneGraph.add(NO_PARENT);
+	earth = add_obj(startProgram, "earth.obj","earth.bmp", earthOrbit);
+	int beltNode = sceneGraph.add(NO_PARENT);
+	object_handle beltFirst = 0;
+	for (int i=0;i<stressCount;i++) {
+		object_handle body;
+		if (i == 0) {
+			body = beltFirst = add_sphere(startProgram, BELT_SLICES, BELT_STACKS, "sun.bmp", beltNode);
+			objects.ambients()[objects.index(body)] = glm::vec3(0.3f);
+		}
+		else
+			body = add_shared_obj(beltFirst, beltNode);
+		beltNodes.push_back(objects.nodes()[objects.index(body)]);
+		sceneGraph.setScale(beltNodes.back(), glm::vec3(BELT_SCALE));
+		// orbit radius, phase, height, speed
+		belt.push_back(glm::vec4(20.0f + 8.0f*rand()/RAND_MAX, 2.0f*PI*rand()/RAND_MAX,
+				2.0f*rand()/RAND_MAX - 1.0f, 0.5f + 1.0f*rand()/RAND_MAX));
+	}
+	reserveFrameData();
 
 	//glCullFace(GL_BACK);
 	// Enable blend mode for billboard
-	glEnable(GL_BLEND);
+	glState.setBlend(true);
 	//glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glProvokingVertex(GL_FIRST_VERTEX_CONVENTION);
 
-	// Initialize framebuffers
-	frameBuffer_init();
+	// Targets of the passes are made by renderGraph when they are first needed
+	screenQuad_init();
+	lensBlur.init();
+	bloom.init();
+	bloom.setRadius(bloomRadius);
+	{
+		// The alpha of bloom.bmp is a soft glow, as lens dirt it brightens the middle of the screen
+		unsigned int width, height;
+		unsigned short int bits;
+		unsigned char *bgr = load_bmp("bloom.bmp", &width, &height, &bits);
+		if (bgr) {
+			bloom.setDirt(width, height, bits, bgr);
+			bloom.setIntensity(0.3f, 0.5f);
+		}
+		delete [] bgr;
+	}
+	renderGraph.init();
+	uniformBlocks.init();
+	streamBuffer.init();
+	gpuProfiler.init();
+	if (!gpuProfileFile.empty() && gpuProfiler.exportTo(gpuProfileFile))
+		gpuProfileRequested = true;
+	gpuProfiler.setEnabled(gpuProfileRequested || hud.isVisible());
+	hud.init();
+	if (!streamBuffer.persistent())
+		std::cout << "Buffer storage is not supported, stream buffer uses orphaning" << std::endl;
 
 	// change program first in order to give uniforms value
 	changeProgram();
 
 	// setup ambient strength
-	objects[earth].ambient = glm::vec3(0.5f);
-	objects[sun].ambient = glm::vec3(1.0f);
+	objects.ambients()[objects.index(earth)] = glm::vec3(0.5f);
+	objects.ambients()[objects.index(sun)] = glm::vec3(1.0f);
 
 	float last, start;
-	last = start = glfwGetTime();
+	last = start = now();
 	int fps=0;
+	unsigned int uniformUploads = 0, uniformSkipped = 0;
+	unsigned int stateIssued = 0, stateFiltered = 0;
+	unsigned int programChanges = 0, textureChanges = 0;
+	double sortTime = 0.0, submitTotal = 0.0;
+	bool firstFrame = true;
 
-	float angle = 5.0f;
-	float rev = 5.0f;
-	float sunAngle = 5.0f;
 	int changeCount = 3;	// the interval to change a shader(in sec)
-	while (!glfwWindowShouldClose(window))
+	moveBelt(animation.rev);
+	if (!benchmarkFile.empty())
+		runBenchmark(window);
+	FILE *checksums = nullptr;
+	if (!checksumFile.empty() && (checksums = fopen(checksumFile.c_str(), "w")) == nullptr)
+		std::cerr << "Cannot write " << checksumFile << std::endl;
+	int frame = 0;
+	double frameStart = now();
+	std::string framePath;				// reused, so writing frames doesn't allocate
+	bool steadyState = false;
+	int steadyFrames = 0, allocatingFrames = 0;
+	// A shading change builds programs the first time, and the driver compiles them
+	// at their first draw in the next frame, neither of them is a steady-state frame
+	int changeFrames = 0;
+	// A benchmark has already rendered all of its frames
+	while (benchmarkFile.empty() && (headless ? frame < frameCount : !glfwWindowShouldClose(window)))
 	{ //program will keep drawing here until you close the window
-		float delta = glfwGetTime() - start;
-		glfwGetCursorPos(window, &xpos, &ypos);
+		PROFILE_FRAME();
+		AllocTracker::beginFrame();
+		double frameNow = now();
+		frameTime = (frameNow-frameStart)*1000.0;
+		frameStart = frameNow;
+		hud.addFrameTime(frameTime);
+		if (!headless)
+			glfwGetCursorPos(window, &xpos, &ypos);
+		UniformTable::uploads = UniformTable::skipped = 0;
+		glState.beginFrame();
 		render();
-		glfwSwapBuffers(window);	// To swap the color buffer in this game loop
-		glfwPollEvents();			// To check if any events are triggered
-
-		// Do the next step for sun rotation, earth rotation and revolution
-		if (playing == true) {
-			angle = angle + 0.1f;
-			sunAngle = sunAngle + 0.003f;
-			rev = rev + 0.01f;
-			glm::mat4 tl=glm::translate(glm::mat4(),glm::vec3(8.0*sin(rev),3.0*sin(rev),16.0*cos(rev)));
-			glm::mat4 rotateM = glm::rotate(glm::mat4(), angle, glm::vec3(0.1f, 1.0f, 0.0f));
-			glm::mat4 sunRotate = glm::rotate(glm::mat4(), sunAngle, glm::vec3(0.0f, 1.0f, 0.0f));
-			objects[earth].model = tl * rotateM;
-			objects[sun].model = sunRotate;
+		uniformUploads += UniformTable::uploads;
+		uniformSkipped += UniformTable::skipped;
+		stateIssued += glState.stats().issued;
+		stateFiltered += glState.stats().filtered;
+		programChanges += programSwitches;
+		textureChanges += textureSwitches;
+		sortTime += renderQueue.lastSortTime();
+		submitTotal += submitTime;
+		// Keep the frame before it is swapped away
+		if (!outputDir.empty() || checksums) {
+			PROFILE_SCOPE("capture frame");
+			frameCapture.read(screenWidth*PIXELMULTI, screenHeight*PIXELMULTI);
+			if (!outputDir.empty()) {
+				char name[32];
+				snprintf(name, sizeof(name), "/frame%04d.bmp", frame);
+				framePath.assign(outputDir);
+				framePath += name;
+				frameCapture.writeBmp(framePath);
+			}
+			if (checksums)
+				fprintf(checksums, "%d %016llx\n", frame, frameCapture.checksum());
+		}
+		frame++;
+		present(window);
+		if (!headless && frameCount > 0 && frame >= frameCount)
+			glfwSetWindowShouldClose(window, GL_TRUE);
+
+		if (firstFrame) {
+			printf("Time to first frame: %.2f ms\n", now()*1000.0);
+			firstFrame = false;
+		}
+		// Programs for other shading modes are finished while we are rendering
+		if (shaderCompiler.pending() > 0) {
+			PROFILE_SCOPE("shader compiler poll");
+			shaderCompiler.poll();
+			if (shaderCompiler.pending() == 0) {
+				printf("All programs ready: %.2f ms\n", now()*1000.0);
+				printPermutations();
+			}
 		}
 
+		if (playing == true)
+			stepAnimation();
+
 		fps++;
-		if(glfwGetTime() - last > 1.0)
+		if(now() - last > 1.0)
 		{
-			if (playing == true) {
+			PROFILE_SCOPE("stats");
+			if (playing == true && !fixedShading) {
 				if (changeCount == 0) {
 					changeProgram();	// time to change program!
 					changeCount = 3;
+					changeFrames = 2;
 				}
 				else
 					changeCount--;
 			}
-			std::cout<<(double)fps/(glfwGetTime()-last)<<std::endl;
+			std::cout<<(double)fps/(now()-last)<<std::endl;
+			if (stressCount > 0)
+				printf("Frame time: %.2f ms, %d objects (%d visible) in %u draw calls, submit %.3f ms\n",
+						(now()-last)*1000.0/fps, (int)objects.size(), (int)visibleObjects.size(), drawCalls, submitTotal/fps);
+			if (printStats) {
+				printf("Uniform uploads per frame: %.1f (skipped %.1f)\n", (double)uniformUploads/fps, (double)uniformSkipped/fps);
+				printf("State changes per frame: %.1f (filtered %.1f)\n", (double)stateIssued/fps, (double)stateFiltered/fps);
+				printf("Program switches per frame: %.1f, texture switches: %.1f, sort %.3f ms\n",
+						(double)programChanges/fps, (double)textureChanges/fps, sortTime/fps);
+			}
+			uniformUploads = uniformSkipped = 0;
+			stateIssued = stateFiltered = 0;
+			programChanges = textureChanges = 0;
+			sortTime = submitTotal = 0.0;
+
+			// Report when the CPU had to wait for the GPU to free a region of the stream buffer
+			const stream_stats &stream = streamBuffer.stats();
+			if (stream.stalls > 0 || stream.resizes > 0)
+				printf("Stream buffer: %u stalls (%.2f ms waiting), %u resizes\n", stream.stalls, stream.stallTime, stream.resizes);
+			streamBuffer.resetStats();
+
+			if (printStats) {
+				const rg_stats &graph = renderGraph.stats();
+				printf("Render graph: %u passes (%u culled), %u targets in %u textures (%u aliased), %u invalidated\n",
+						graph.passes, graph.culled, graph.transients, graph.textures, graph.aliased, graph.invalidated);
+			}
+
+			if (gpuProfileRequested)
+				gpuProfiler.printAverages();
+
+			// Report texture memory when something was evicted or restored
+			const texture_stats &tex = textureManager.stats();
+			static unsigned int lastChanges = 0;
+			if (tex.demotions+tex.evictions+tex.restores != lastChanges) {
+				std::cout << "Texture memory: " << tex.usedBytes/1024 << " KB / " << tex.budgetBytes/1024
+					<< " KB, demotions " << tex.demotions << ", evictions " << tex.evictions
+					<< ", restores " << tex.restores << std::endl;
+				lastChanges = tex.demotions+tex.evictions+tex.restores;
+			}
 			fps = 0;
-			last = glfwGetTime();
+			last = now();
+		}
+
+		if (checkAllocations) {
+			alloc_stats alloc = AllocTracker::frame();
+			bool counted = steadyState && changeFrames == 0;
+			if (changeFrames > 0)
+				changeFrames--;
+			if (counted)
+				steadyFrames++;
+			if (counted && alloc.allocations > 0) {
+				printf("Frame %d: %llu allocations (%llu bytes)\n", frame-1, alloc.allocations, alloc.bytes);
+				AllocTracker::printSites();
+				allocatingFrames++;
+			}
+			AllocTracker::clearSites();
+			// Programs are finished in the background while the first frames are drawn
+			if (!steadyState && shaderCompiler.pending() == 0) {
+				steadyState = true;
+				AllocTracker::setCapture(true);
+			}
 		}
 	}
 
 	// End of the program
+	if (headless && benchmarkFile.empty())
+		printf("Rendered %d frames of %dx%d in %.2f ms\n", frame, screenWidth, screenHeight, (now()-start)*1000.0);
+	if (checksums)
+		fclose(checksums);
+	if (traceOnExit)
+		CpuProfiler::writeTrace(traceFile, traceFrames);
+	if (checkAllocations) {
+		AllocTracker::setCapture(false);
+		if (allocatingFrames > 0)
+			printf("Allocation check failed: %d of %d steady-state frames allocated\n", allocatingFrames, steadyFrames);
+		else
+			printf("Allocation check passed: no allocations in %d steady-state frames\n", steadyFrames);
+	}
 	releaseObjects();
-	glfwDestroyWindow(window);
-	glfwTerminate();
-	return EXIT_SUCCESS;
+	if (headless)
+		headlessContext.release();
+	else {
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
+	return (allocatingFrames > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,196 @@
+#include "object_store.h"
+#include "cpu_profiler.h"
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <glm/gtc/matrix_transform.hpp>
+
+object_handle ObjectStore::add()
+{
+	object_handle handle;
+	if (!freeHandles.empty()) {
+		handle = freeHandles.back();
+		freeHandles.pop_back();
+	}
+	else {
+		handle = indices.size();
+		indices.push_back(0);
+	}
+	indices[handle] = handles.size();
+	handles.push_back(handle);
+
+	programData.push_back(0);
+	textureData.push_back(0);
+	meshData.push_back(-1);
+	nodeData.push_back(-1);
+	ambientData.push_back(glm::vec3(0.0f));
+	boundData.push_back(glm::vec4(0.0f));
+	sharedData.push_back(0);
+	return handle;
+}
+
+void ObjectStore::remove(object_handle handle)
+{
+	size_t hole = indices[handle];
+	size_t last = handles.size()-1;
+
+	// Move the last object into the hole
+	programData[hole] = programData[last];
+	textureData[hole] = textureData[last];
+	meshData[hole] = meshData[last];
+	nodeData[hole] = nodeData[last];
+	ambientData[hole] = ambientData[last];
+	boundData[hole] = boundData[last];
+	sharedData[hole] = sharedData[last];
+	handles[hole] = handles[last];
+	indices[handles[hole]] = hole;
+
+	programData.pop_back();
+	textureData.pop_back();
+	meshData.pop_back();
+	nodeData.pop_back();
+	ambientData.pop_back();
+	boundData.pop_back();
+	sharedData.pop_back();
+	handles.pop_back();
+	freeHandles.push_back(handle);
+}
+
+// Frustum planes from the rows of the view-projection matrix (Gribb/Hartmann),
+// normalized so the distance to them can be compared with a radius
+static void frustumPlanes(const glm::mat4 &vp, glm::vec4 planes[6])
+{
+	glm::vec4 rows[4];
+	for (int r=0;r<4;r++)
+		rows[r] = glm::vec4(vp[0][r], vp[1][r], vp[2][r], vp[3][r]);
+	for (int p=0;p<3;p++) {
+		planes[2*p] = rows[3]+rows[p];
+		planes[2*p+1] = rows[3]-rows[p];
+	}
+	for (int p=0;p<6;p++)
+		planes[p] /= glm::length(glm::vec3(planes[p]));
+}
+
+static inline bool insideFrustum(const glm::vec4 planes[6], const glm::vec4 &sphere)
+{
+	// No early out, so the compiler can keep it branch free
+	bool inside = true;
+	for (int p=0;p<6;p++)
+		inside &= planes[p].x*sphere.x + planes[p].y*sphere.y + planes[p].z*sphere.z + planes[p].w >= -sphere.w;
+	return inside;
+}
+
+void cull_objects(const glm::mat4 &vp, const glm::vec4 *bounds, size_t count, std::vector<uint32_t> &visible)
+{
+	PROFILE_SCOPE("culling");
+	glm::vec4 planes[6];
+	frustumPlanes(vp, planes);
+	visible.clear();
+	for (size_t i=0;i<count;i++)
+		if (insideFrustum(planes, bounds[i]))
+			visible.push_back(i);
+}
+
+// Layout of objects before ObjectStore
+struct legacy_object{
+	unsigned int program;
+	unsigned int vao;
+	unsigned int vbo[4];
+	unsigned int texture;
+	glm::mat4 model;
+	glm::vec3 ambient;
+};
+
+static double elapsed(std::chrono::steady_clock::time_point begin)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-begin).count();
+}
+
+// Sort key of a draw, like RenderQueue::push
+static uint64_t drawKey(unsigned int program, unsigned int texture, unsigned int mesh, float depth)
+{
+	return ((uint64_t)(program & 0xFFF) << 48) | ((uint64_t)(texture & 0x3FFF) << 34) |
+		((uint64_t)(mesh & 0x3FFF) << 20) | (uint64_t)(depth*0xFFFFF);
+}
+
+void benchmark_object_store()
+{
+	glm::vec3 eye(40.0f, 15.0f, 40.0f);
+	glm::mat4 vp = glm::perspective(glm::radians(24.0f), 800.0f/600, 1.0f, 100.f)*
+			glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	float radius = 0.2f;
+	size_t sizes[] = {1000, 10000, 100000};
+	int runs = 50;
+
+	for (int s=0;s<3;s++) {
+		size_t count = sizes[s];
+		// Same random scene in both layouts, about half of it is visible
+		std::vector<legacy_object> legacy(count);
+		ObjectStore store;
+		std::vector<glm::mat4> worlds(count);		// what the scene graph holds
+		for (size_t i=0;i<count;i++) {
+			glm::vec3 pos(rand()%80-40, rand()%20-10, rand()%80-40);
+			legacy_object &o = legacy[i];
+			o.program = 1+rand()%4;
+			o.vao = 1+rand()%32;
+			o.texture = 1+rand()%16;
+			o.model = glm::translate(glm::mat4(1.0f), pos);
+			o.ambient = glm::vec3(0.5f);
+
+			size_t n = store.index(store.add());
+			store.programs()[n] = o.program;
+			store.meshes()[n] = o.vao;
+			store.textures()[n] = o.texture;
+			store.ambients()[n] = o.ambient;
+			worlds[n] = o.model;
+		}
+		std::vector<uint32_t> visible;
+		std::vector<uint64_t> keys;
+		keys.reserve(count);
+		visible.reserve(count);
+
+		// Array of structures: every pass reads whole records
+		double legacyTime = 0.0;
+		for (int r=0;r<runs;r++) {
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			glm::vec4 planes[6];
+			frustumPlanes(vp, planes);
+			visible.clear();
+			for (size_t i=0;i<count;i++)
+				if (insideFrustum(planes, glm::vec4(glm::vec3(legacy[i].model[3]), radius)))
+					visible.push_back(i);
+			keys.clear();
+			for (size_t v=0;v<visible.size();v++) {
+				const legacy_object &o = legacy[visible[v]];
+				float depth = glm::distance(eye, glm::vec3(o.model[3])) / 100.0f;
+				keys.push_back(drawKey(o.program, o.texture, o.vao, depth));
+			}
+			legacyTime += elapsed(begin);
+		}
+		size_t legacyCount = keys.size();
+
+		// Structure of arrays: bounds from the transforms, cull on bounds only,
+		// then build draws from the handles of the visible objects
+		double storeTime = 0.0;
+		for (int r=0;r<runs;r++) {
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			glm::vec4 *bounds = store.bounds();
+			for (size_t i=0;i<count;i++)
+				bounds[i] = glm::vec4(glm::vec3(worlds[i][3]), radius);
+			cull_objects(vp, bounds, count, visible);
+			keys.clear();
+			const unsigned int *programs = store.programs(), *textures = store.textures();
+			const int *meshes = store.meshes();
+			for (size_t v=0;v<visible.size();v++) {
+				uint32_t i = visible[v];
+				float depth = glm::distance(eye, glm::vec3(bounds[i])) / 100.0f;
+				keys.push_back(drawKey(programs[i], textures[i], meshes[i], depth));
+			}
+			storeTime += elapsed(begin);
+		}
+		if (keys.size() != legacyCount)
+			printf("Object store: layouts disagree on visible objects!\n");
+		printf("Object store: %6zu objects, %6zu visible, array of structs %.3f ms, struct of arrays %.3f ms\n",
+				count, keys.size(), legacyTime/runs, storeTime/runs);
+	}
+}
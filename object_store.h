@@ -0,0 +1,58 @@
+#ifndef OBJECT_STORE_H
+#define OBJECT_STORE_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <glm/glm.hpp>
+
+typedef unsigned int object_handle;
+
+// Renderable objects as a structure of arrays.
+// Every property lives in its own contiguous array, indexed by a dense index
+// [0, size()), so every pass over the objects only touches the arrays it needs:
+//   bounds                      culling
+//   programs, textures, meshes  building the draw list
+//   nodes                       transforms (world matrices are in the scene graph)
+//   ambients                    material parameters
+// Objects are referred to by handles, which stay valid when other objects are
+// removed. Removing moves the last object into the hole, so dense indices change.
+class ObjectStore{
+public:
+	object_handle add();
+	void remove(object_handle handle);
+	size_t size() const { return handles.size(); }
+
+	// Dense index of a live object
+	size_t index(object_handle handle) const { return indices[handle]; }
+	object_handle handle(size_t index) const { return handles[index]; }
+
+	unsigned int *programs() { return programData.data(); }
+	unsigned int *textures() { return textureData.data(); }
+	int *meshes() { return meshData.data(); }				// in the geometry buffer
+	int *nodes() { return nodeData.data(); }				// in the scene graph
+	glm::vec3 *ambients() { return ambientData.data(); }
+	glm::vec4 *bounds() { return boundData.data(); }		// world space sphere, center and radius
+	unsigned char *shared() { return sharedData.data(); }	// texture belongs to another object
+
+private:
+	std::vector<unsigned int> programData, textureData;
+	std::vector<int> meshData, nodeData;
+	std::vector<glm::vec3> ambientData;
+	std::vector<glm::vec4> boundData;
+	std::vector<unsigned char> sharedData;
+
+	std::vector<object_handle> handles;		// handle of every dense index
+	std::vector<size_t> indices;			// dense index of every handle
+	std::vector<object_handle> freeHandles;
+};
+
+// Write the dense indices of the spheres in `bounds` which are inside the view
+// frustum of `vp` into `visible`
+void cull_objects(const glm::mat4 &vp, const glm::vec4 *bounds, size_t count, std::vector<uint32_t> &visible);
+
+// Run culling and draw list building over 1k/10k/100k objects stored as an
+// array of structures and as an ObjectStore, print the time of both
+void benchmark_object_store();
+
+#endif // OBJECT_STORE_H
@@ -0,0 +1,122 @@
+#include "program_cache.h"
+#include <cstdio>
+#include <vector>
+#ifdef _WIN32
+	#include <direct.h>
+	#define make_dir(name) _mkdir(name)
+#else
+	#include <sys/stat.h>
+	#define make_dir(name) mkdir(name, 0755)
+#endif
+
+// "HW4B", written at the beginning of each cache file
+#define CACHE_MAGIC 0x42345748u
+
+// 64-bit FNV-1a hash
+static unsigned long long fnv1a(const std::string &data, unsigned long long hash = 14695981039346656037ULL)
+{
+	for (size_t i=0;i<data.size();i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+ProgramCache::ProgramCache(const std::string &directory): dir(directory), usable(false)
+{
+}
+
+bool ProgramCache::init()
+{
+	usable = false;
+	if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary)
+		return false;
+
+	// Some drivers expose the extension without any binary format
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (formats <= 0)
+		return false;
+
+	driver = std::string((const char*)glGetString(GL_VENDOR)) + "|" +
+		(const char*)glGetString(GL_RENDERER) + "|" + (const char*)glGetString(GL_VERSION);
+	make_dir(dir.c_str());
+	usable = true;
+	return true;
+}
+
+std::string ProgramCache::path(const std::string &vertex_shader, const std::string &fragment_shader) const
+{
+	// Separate the parts, so that moving text from vs to fs changes the key
+	unsigned long long hash = fnv1a(vertex_shader);
+	hash = fnv1a(std::string(1, '\0') + fragment_shader, hash);
+	hash = fnv1a(std::string(1, '\0') + driver, hash);
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bin", hash);
+	return dir + "/" + name;
+}
+
+unsigned int ProgramCache::load(const std::string &vertex_shader, const std::string &fragment_shader)
+{
+	if (!usable)
+		return 0;
+	std::string filename = path(vertex_shader, fragment_shader);
+	FILE *fp = fopen(filename.c_str(), "rb");
+	if (!fp)
+		return 0;
+
+	unsigned int header[3];		// magic, binary format, length
+	std::vector<char> binary;
+	bool ok = fread(header, sizeof(header), 1, fp) == 1 && header[0] == CACHE_MAGIC && header[2] > 0;
+	if (ok) {
+		binary.resize(header[2]);
+		ok = fread(binary.data(), 1, binary.size(), fp) == binary.size();
+	}
+	fclose(fp);
+	if (!ok) {
+		remove(filename.c_str());
+		return 0;
+	}
+
+	unsigned int program = glCreateProgram();
+	glProgramBinary(program, header[1], binary.data(), binary.size());
+
+	// The driver may still reject it (e.g. same version string but different build)
+	int status;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status == GL_FALSE) {
+		glDeleteProgram(program);
+		remove(filename.c_str());
+		return 0;
+	}
+	return program;
+}
+
+void ProgramCache::save(unsigned int program, const std::string &vertex_shader, const std::string &fragment_shader)
+{
+	if (!usable || program == 0)
+		return;
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	std::vector<char> binary(length);
+	GLenum format;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+
+	// Write to a temporary file first, so a crash never leaves a broken cache file
+	std::string filename = path(vertex_shader, fragment_shader);
+	std::string temp = filename + ".tmp";
+	FILE *fp = fopen(temp.c_str(), "wb");
+	if (!fp)
+		return;
+	unsigned int header[3] = {CACHE_MAGIC, format, (unsigned int)length};
+	bool ok = fwrite(header, sizeof(header), 1, fp) == 1 &&
+		fwrite(binary.data(), 1, length, fp) == (size_t)length;
+	fclose(fp);
+	remove(filename.c_str());
+	if (!ok || rename(temp.c_str(), filename.c_str()) != 0)
+		remove(temp.c_str());
+}
@@ -0,0 +1,32 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <GL/glew.h>
+#include <string>
+
+// On-disk cache of linked program binaries (glGetProgramBinary/glProgramBinary).
+// A binary is keyed by a hash of the vertex and fragment source together with
+// the GL vendor, renderer and version string, so changing a shader or updating
+// the driver simply misses the cache and the program is built again.
+class ProgramCache{
+public:
+	ProgramCache(const std::string &directory);
+
+	// Must be called with a current GL context, returns false if binaries are not supported
+	bool init();
+	bool enabled() const { return usable; }
+
+	// Return a linked program from the cache, or 0 if there is none (or it is stale)
+	unsigned int load(const std::string &vertex_shader, const std::string &fragment_shader);
+	// Store a linked program into the cache
+	void save(unsigned int program, const std::string &vertex_shader, const std::string &fragment_shader);
+
+private:
+	std::string path(const std::string &vertex_shader, const std::string &fragment_shader) const;
+
+	std::string dir;
+	std::string driver;		// vendor, renderer and version string of current context
+	bool usable;
+};
+
+#endif // PROGRAM_CACHE_H
@@ -0,0 +1,533 @@
+#include "render_graph.h"
+#include "gl_state.h"
+#include "gpu_profiler.h"
+#include "cpu_profiler.h"
+#include <cstdio>
+#include <cstring>
+
+static bool isDepth(GLenum format)
+{
+	return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8 || format == GL_DEPTH_COMPONENT16 ||
+			format == GL_DEPTH_COMPONENT24 || format == GL_DEPTH_COMPONENT32 || format == GL_DEPTH_COMPONENT32F;
+}
+
+static GLenum depthAttachmentOf(GLenum format)
+{
+	return (format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8) ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+}
+
+// Bytes of a texel of the internal `format` as drivers store it, RGB8 is padded to 4
+static size_t texelBytes(GLenum format)
+{
+	switch (format) {
+		case GL_DEPTH_COMPONENT16:	return 2;
+		case GL_DEPTH32F_STENCIL8:
+		case GL_RGBA16F:			return 8;
+		case GL_RGB16F:				return 6;
+		case GL_RGB32F:				return 12;
+		case GL_RGBA32F:			return 16;
+		default:					return 4;
+	}
+}
+
+// Pixel format and type glTexImage2D accepts with the internal `format`
+static void pixelFormatOf(GLenum format, GLenum &pixels, GLenum &type)
+{
+	switch (format) {
+		case GL_DEPTH24_STENCIL8:	pixels = GL_DEPTH_STENCIL; type = GL_UNSIGNED_INT_24_8; break;
+		case GL_DEPTH32F_STENCIL8:	pixels = GL_DEPTH_STENCIL; type = GL_FLOAT_32_UNSIGNED_INT_24_8_REV; break;
+		case GL_DEPTH_COMPONENT32F:	pixels = GL_DEPTH_COMPONENT; type = GL_FLOAT; break;
+		case GL_DEPTH_COMPONENT16:
+		case GL_DEPTH_COMPONENT24:
+		case GL_DEPTH_COMPONENT32:	pixels = GL_DEPTH_COMPONENT; type = GL_UNSIGNED_INT; break;
+		case GL_RGB16F:
+		case GL_RGB32F:
+		case GL_R11F_G11F_B10F:		pixels = GL_RGB; type = GL_FLOAT; break;
+		case GL_RGBA16F:
+		case GL_RGBA32F:			pixels = GL_RGBA; type = GL_FLOAT; break;
+		case GL_RGB8:				pixels = GL_RGB; type = GL_UNSIGNED_BYTE; break;
+		default:					pixels = GL_RGBA; type = GL_UNSIGNED_BYTE; break;
+	}
+}
+
+static bool contains(const rg_resource *list, int count, rg_resource resource)
+{
+	for (int i=0;i<count;i++)
+		if (list[i] == resource)
+			return true;
+	return false;
+}
+
+RenderGraph::RenderGraph(): resourceCount(0), passCount(0), group(nullptr), poolCount(0), framebufferCount(0), poolBytes(0), frame(0),
+		invalidateSupported(false), warned(false)
+{
+	memset(&stat, 0, sizeof(stat));
+}
+
+void RenderGraph::init()
+{
+	invalidateSupported = GLEW_VERSION_4_3 || GLEW_ARB_invalidate_subdata;
+}
+
+void RenderGraph::release()
+{
+	glState.bindFramebuffer(0);
+	for (int i=0;i<framebufferCount;i++)
+		glDeleteFramebuffers(1, &framebuffers[i].framebuffer);
+	for (int i=0;i<poolCount;i++) {
+		glDeleteTextures(1, &pool[i].texture);
+		glState.deletedTexture(pool[i].texture);
+	}
+	framebufferCount = poolCount = 0;
+	poolBytes = 0;
+	reset();
+}
+
+void RenderGraph::reset()
+{
+	resourceCount = passCount = 0;
+	group = nullptr;
+}
+
+rg_resource RenderGraph::import(const char *name, GLuint framebuffer, int width, int height)
+{
+	rg_resource resource = create(name, width, height, GL_NONE);
+	if (resource == RG_NONE)
+		return RG_NONE;
+	resources[resource].imported = true;
+	resources[resource].framebuffer = framebuffer;
+	return resource;
+}
+
+rg_resource RenderGraph::create(const char *name, int width, int height, GLenum format)
+{
+	if (resourceCount == RENDER_GRAPH_RESOURCES) {
+		if (!warned)
+			fprintf(stderr, "Render graph: more than %d targets, %s is left out\n", RENDER_GRAPH_RESOURCES, name);
+		warned = true;
+		return RG_NONE;
+	}
+	resource_entry &resource = resources[resourceCount];
+	resource.name = name;
+	resource.width = width;
+	resource.height = height;
+	resource.format = format;
+	resource.framebuffer = 0;
+	resource.imported = resource.output = resource.needed = false;
+	resource.first = resource.last = -1;
+	resource.texture = -1;
+	return resourceCount++;
+}
+
+int RenderGraph::addPass(const char *name, rg_execute execute, void *user)
+{
+	if (passCount == RENDER_GRAPH_PASSES) {
+		if (!warned)
+			fprintf(stderr, "Render graph: more than %d passes, %s is left out\n", RENDER_GRAPH_PASSES, name);
+		warned = true;
+		return -1;
+	}
+	pass_entry &pass = passes[passCount];
+	pass.name = name;
+	pass.group = group;
+	pass.execute = execute;
+	pass.user = user;
+	pass.readCount = pass.writeCount = 0;
+	pass.stores = 0;
+	pass.culled = false;
+	return passCount++;
+}
+
+void RenderGraph::read(int pass, rg_resource resource)
+{
+	if (pass < 0 || resource == RG_NONE || contains(passes[pass].reads, passes[pass].readCount, resource))
+		return;
+	if (passes[pass].readCount+passes[pass].writeCount == RENDER_GRAPH_ACCESSES) {
+		if (!warned)
+			fprintf(stderr, "Render graph: pass %s uses more than %d targets\n", passes[pass].name, RENDER_GRAPH_ACCESSES);
+		warned = true;
+		return;
+	}
+	passes[pass].reads[passes[pass].readCount++] = resource;
+}
+
+void RenderGraph::write(int pass, rg_resource resource)
+{
+	if (pass < 0 || resource == RG_NONE || contains(passes[pass].writes, passes[pass].writeCount, resource))
+		return;
+	if (passes[pass].readCount+passes[pass].writeCount == RENDER_GRAPH_ACCESSES) {
+		if (!warned)
+			fprintf(stderr, "Render graph: pass %s uses more than %d targets\n", passes[pass].name, RENDER_GRAPH_ACCESSES);
+		warned = true;
+		return;
+	}
+	passes[pass].writes[passes[pass].writeCount++] = resource;
+}
+
+void RenderGraph::store(int pass, rg_resource resource)
+{
+	write(pass, resource);
+	for (int i=0;pass >= 0 && i<passes[pass].writeCount;i++)
+		if (passes[pass].writes[i] == resource)
+			passes[pass].stores |= 1u << i;
+}
+
+void RenderGraph::output(rg_resource resource)
+{
+	if (resource != RG_NONE)
+		resources[resource].output = true;
+}
+
+// True if `pass` must run after `other`: it reads what `other` writes, or both
+// write the same target and `other` was added first
+bool RenderGraph::dependsOn(int pass, int other) const
+{
+	if (pass == other)
+		return false;
+	const pass_entry &a = passes[pass], &b = passes[other];
+	for (int i=0;i<b.writeCount;i++) {
+		if (contains(a.reads, a.readCount, b.writes[i]))
+			return true;
+		if (other < pass && contains(a.writes, a.writeCount, b.writes[i]))
+			return true;
+	}
+	return false;
+}
+
+// Every step takes the first pass added whose dependencies all ran, so passes
+// which don't depend on each other keep the order they were added in
+bool RenderGraph::sort()
+{
+	bool placed[RENDER_GRAPH_PASSES] = {false};
+	for (int n=0;n<passCount;n++) {
+		int next = -1;
+		for (int j=0;j<passCount && next < 0;j++) {
+			if (placed[j])
+				continue;
+			bool ready = true;
+			for (int i=0;i<passCount && ready;i++)
+				if (!placed[i] && dependsOn(j, i))
+					ready = false;
+			if (ready)
+				next = j;
+		}
+		if (next < 0)
+			return false;
+		placed[next] = true;
+		order[n] = next;
+	}
+	return true;
+}
+
+// Walk back from the outputs, a pass is needed if it writes something needed
+void RenderGraph::cull()
+{
+	for (int i=0;i<resourceCount;i++)
+		resources[i].needed = resources[i].output;
+	for (int n=passCount-1;n>=0;n--) {
+		pass_entry &pass = passes[order[n]];
+		pass.culled = true;
+		for (int i=0;i<pass.writeCount && pass.culled;i++)
+			if (resources[pass.writes[i]].needed)
+				pass.culled = false;
+		if (pass.culled) {
+			stat.culled++;
+			continue;
+		}
+		for (int i=0;i<pass.readCount;i++)
+			resources[pass.reads[i]].needed = true;
+	}
+
+	// Lifetimes over the passes left
+	for (int n=0;n<passCount;n++) {
+		const pass_entry &pass = passes[order[n]];
+		if (pass.culled)
+			continue;
+		for (int k=0;k<pass.readCount+pass.writeCount;k++) {
+			resource_entry &resource = resources[k < pass.readCount ? pass.reads[k] : pass.writes[k-pass.readCount]];
+			if (resource.first < 0)
+				resource.first = n;
+			resource.last = n;
+		}
+	}
+}
+
+// A free pooled texture like `resource`, or a new one
+int RenderGraph::findTexture(const resource_entry &resource)
+{
+	for (int i=0;i<poolCount;i++) {
+		pool_texture &entry = pool[i];
+		if (entry.busyUntil < 0 && entry.width == resource.width && entry.height == resource.height && entry.format == resource.format) {
+			if (entry.lastFrame == frame)
+				stat.aliased++;
+			return i;
+		}
+	}
+	if (poolCount == RENDER_GRAPH_POOL) {
+		if (!warned)
+			fprintf(stderr, "Render graph: more than %d textures, %s is not allocated\n", RENDER_GRAPH_POOL, resource.name);
+		warned = true;
+		return -1;
+	}
+
+	pool_texture &entry = pool[poolCount];
+	entry.width = resource.width;
+	entry.height = resource.height;
+	entry.format = resource.format;
+	entry.bytes = texelBytes(resource.format)*resource.width*resource.height;
+	entry.busyUntil = -1;
+	GLenum pixels, type;
+	pixelFormatOf(resource.format, pixels, type);
+	glGenTextures(1, &entry.texture);
+	glState.editTexture(entry.texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, resource.format, resource.width, resource.height, 0, pixels, type, NULL);
+	// Post processing reads colors filtered and past the edges
+	GLint filter = isDepth(resource.format) ? GL_NEAREST : GL_LINEAR;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glState.bindTexture(0, 0);
+	stat.created++;
+	poolBytes += entry.bytes;
+	return poolCount++;
+}
+
+// Textures for the targets whose lifetime starts at `position`
+void RenderGraph::acquireTargets(int position)
+{
+	for (int i=0;i<resourceCount;i++) {
+		resource_entry &resource = resources[i];
+		if (resource.imported || resource.first != position)
+			continue;
+		resource.texture = findTexture(resource);
+		if (resource.texture < 0)
+			continue;
+		pool[resource.texture].busyUntil = resource.last;
+		pool[resource.texture].lastFrame = frame;
+		stat.transients++;
+	}
+}
+
+// Textures of the targets whose lifetime ends at `position` can be used again
+void RenderGraph::releaseTargets(int position)
+{
+	for (int i=0;i<poolCount;i++)
+		if (pool[i].busyUntil == position)
+			pool[i].busyUntil = -1;
+}
+
+GLuint RenderGraph::findFramebuffer(const GLuint attachments[RENDER_GRAPH_COLORS+1], GLenum depthAttachment)
+{
+	for (int i=0;i<framebufferCount;i++) {
+		if (memcmp(framebuffers[i].attachments, attachments, sizeof(framebuffers[i].attachments)) == 0) {
+			framebuffers[i].lastFrame = frame;
+			return framebuffers[i].framebuffer;
+		}
+	}
+
+	// Full, the one unused longest makes room
+	int slot = framebufferCount;
+	if (framebufferCount == RENDER_GRAPH_FRAMEBUFFERS) {
+		slot = 0;
+		for (int i=1;i<framebufferCount;i++)
+			if (framebuffers[i].lastFrame < framebuffers[slot].lastFrame)
+				slot = i;
+		glState.bindFramebuffer(0);
+		glDeleteFramebuffers(1, &framebuffers[slot].framebuffer);
+	}
+	else
+		framebufferCount++;
+
+	framebuffer_entry &entry = framebuffers[slot];
+	memcpy(entry.attachments, attachments, sizeof(entry.attachments));
+	entry.lastFrame = frame;
+	glGenFramebuffers(1, &entry.framebuffer);
+	glState.bindFramebuffer(entry.framebuffer);
+	GLenum drawBuffers[RENDER_GRAPH_COLORS];
+	int colors = 0;
+	for (int i=0;i<RENDER_GRAPH_COLORS;i++) {
+		if (attachments[i] == 0)
+			continue;
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0+i, GL_TEXTURE_2D, attachments[i], 0);
+		drawBuffers[colors++] = GL_COLOR_ATTACHMENT0+i;
+	}
+	if (attachments[RENDER_GRAPH_COLORS])
+		glFramebufferTexture2D(GL_FRAMEBUFFER, depthAttachment, GL_TEXTURE_2D, attachments[RENDER_GRAPH_COLORS], 0);
+	if (colors > 0)
+		glDrawBuffers(colors, drawBuffers);
+	else
+		glDrawBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		fprintf(stderr, "Render graph: framebuffer is not complete\n");
+	stat.created++;
+	return entry.framebuffer;
+}
+
+GLuint RenderGraph::framebuffer(rg_resource resource)
+{
+	const resource_entry &entry = resources[resource];
+	if (entry.imported)
+		return entry.framebuffer;
+	GLuint attachments[RENDER_GRAPH_COLORS+1] = {0};
+	attachments[isDepth(entry.format) ? RENDER_GRAPH_COLORS : 0] = texture(resource);
+	return findFramebuffer(attachments, depthAttachmentOf(entry.format));
+}
+
+GLuint RenderGraph::texture(rg_resource resource) const
+{
+	const resource_entry &entry = resources[resource];
+	if (entry.imported || entry.texture < 0)
+		return 0;
+	return pool[entry.texture].texture;
+}
+
+// Bind the framebuffer of what `pass` writes and set the viewport to it.
+// Returns false if the pass only stores images, nothing is bound then
+bool RenderGraph::bindPass(const pass_entry &pass, GLuint &framebuffer)
+{
+	GLuint attachments[RENDER_GRAPH_COLORS+1] = {0};
+	GLenum depthAttachment = GL_DEPTH_ATTACHMENT;
+	bool imported = false;
+	int colors = 0, attached = -1;
+	framebuffer = 0;
+	for (int i=0;i<pass.writeCount;i++) {
+		const resource_entry &resource = resources[pass.writes[i]];
+		if (pass.stores & (1u << i))
+			continue;
+		if (attached < 0)
+			attached = i;
+		if (resource.imported) {
+			framebuffer = resource.framebuffer;
+			imported = true;
+		}
+		else if (isDepth(resource.format)) {
+			attachments[RENDER_GRAPH_COLORS] = texture(pass.writes[i]);
+			depthAttachment = depthAttachmentOf(resource.format);
+		}
+		else if (colors < RENDER_GRAPH_COLORS)
+			attachments[colors++] = texture(pass.writes[i]);
+	}
+	if (pass.writeCount > 0 && attached < 0)
+		return false;
+	if (!imported && attached >= 0)
+		framebuffer = findFramebuffer(attachments, depthAttachment);
+	glState.bindFramebuffer(framebuffer);
+	if (attached >= 0)
+		glViewport(0, 0, resources[pass.writes[attached]].width, resources[pass.writes[attached]].height);
+	return true;
+}
+
+// Before the pass: attachments nothing was drawn into yet. After it: attachments no
+// later pass uses. Targets drawn into together with an imported framebuffer are skipped.
+// Stored images are invalidated as textures
+void RenderGraph::invalidate(const pass_entry &pass, int position, bool before)
+{
+	if (!invalidateSupported)
+		return;
+	GLenum attachments[RENDER_GRAPH_COLORS+1];
+	int count = 0, colors = 0;
+	for (int i=0;i<pass.writeCount;i++) {
+		const resource_entry &resource = resources[pass.writes[i]];
+		if (resource.imported)
+			return;
+		bool dead = before ? resource.first == position : (resource.last == position && !resource.output);
+		if (pass.stores & (1u << i)) {
+			if (dead && resource.texture >= 0) {
+				glInvalidateTexImage(pool[resource.texture].texture, 0);
+				stat.invalidated++;
+			}
+			continue;
+		}
+		GLenum attachment = isDepth(resource.format) ? depthAttachmentOf(resource.format) : GL_COLOR_ATTACHMENT0+colors++;
+		if (dead && count < RENDER_GRAPH_COLORS+1)
+			attachments[count++] = attachment;
+	}
+	if (count == 0)
+		return;
+	glInvalidateFramebuffer(GL_FRAMEBUFFER, count, attachments);
+	stat.invalidated += count;
+}
+
+// Textures not used for a while are deleted, with the framebuffers they are attached to
+void RenderGraph::trimPool()
+{
+	for (int i=0;i<poolCount;) {
+		if (frame-pool[i].lastFrame <= RENDER_GRAPH_KEEP) {
+			i++;
+			continue;
+		}
+		GLuint texture = pool[i].texture;
+		for (int f=0;f<framebufferCount;) {
+			bool attached = false;
+			for (int k=0;k<=RENDER_GRAPH_COLORS;k++)
+				if (framebuffers[f].attachments[k] == texture)
+					attached = true;
+			if (!attached) {
+				f++;
+				continue;
+			}
+			glState.bindFramebuffer(0);
+			glDeleteFramebuffers(1, &framebuffers[f].framebuffer);
+			framebuffers[f] = framebuffers[--framebufferCount];
+		}
+		glDeleteTextures(1, &texture);
+		glState.deletedTexture(texture);
+		poolBytes -= pool[i].bytes;
+		pool[i] = pool[--poolCount];
+	}
+}
+
+void RenderGraph::execute(GpuProfiler *profiler)
+{
+	PROFILE_SCOPE("render graph");
+	frame++;
+	memset(&stat, 0, sizeof(stat));
+	// Passes like the HUD see the pool of the last frame
+	stat.pooledBytes = poolBytes;
+	if (!sort()) {
+		if (!warned)
+			fprintf(stderr, "Render graph: passes depend on each other in a cycle, they run in the order they were added\n");
+		warned = true;
+		for (int i=0;i<passCount;i++)
+			order[i] = i;
+	}
+	cull();
+
+	const char *openGroup = nullptr;
+	for (int n=0;n<passCount;n++) {
+		const pass_entry &pass = passes[order[n]];
+		if (pass.culled)
+			continue;
+		if (pass.group != openGroup && profiler) {
+			if (openGroup)
+				profiler->end();
+			if (pass.group)
+				profiler->begin(pass.group);
+		}
+		openGroup = pass.group;
+		acquireTargets(n);
+		PROFILE_SCOPE(pass.name);
+		if (profiler)
+			profiler->begin(pass.name);
+		GLuint framebuffer;
+		bool attached = bindPass(pass, framebuffer);
+		invalidate(pass, n, true);
+		pass.execute(*this, pass.user);
+		if (attached)
+			glState.bindFramebuffer(framebuffer);
+		invalidate(pass, n, false);
+		// Images stored by the pass are read as textures or blitted from later
+		if (pass.stores)
+			glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+		if (profiler)
+			profiler->end();
+		releaseTargets(n);
+		stat.passes++;
+	}
+	if (openGroup && profiler)
+		profiler->end();
+	trimPool();
+	stat.textures = poolCount;
+	stat.pooledBytes = poolBytes;
+}
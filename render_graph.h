@@ -0,0 +1,150 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include <GL/glew.h>
+#include <cstddef>
+
+class GpuProfiler;
+
+#define RENDER_GRAPH_PASSES 32			// passes of one frame
+#define RENDER_GRAPH_RESOURCES 32		// targets of one frame
+#define RENDER_GRAPH_ACCESSES 8			// reads and writes of one pass each
+#define RENDER_GRAPH_COLORS 4			// color attachments of one pass
+#define RENDER_GRAPH_POOL 32			// textures kept between frames
+#define RENDER_GRAPH_FRAMEBUFFERS 32	// framebuffer objects kept between frames
+#define RENDER_GRAPH_KEEP 8				// frames an unused pooled texture is kept
+
+typedef int rg_resource;		// target of the frame being built
+#define RG_NONE -1
+
+class RenderGraph;
+// Issues the GL commands of a pass. The framebuffer of what the pass writes is bound
+// and the viewport covers it when this is called, unless it only stores images
+typedef void (*rg_execute)(RenderGraph &graph, void *user);
+
+// Counters of the last frame
+struct rg_stats{
+	unsigned int passes;		// passes run
+	unsigned int culled;		// passes nothing in the output depends on
+	unsigned int transients;	// targets living only in the frame
+	unsigned int aliased;		// transients given a texture an earlier transient was done with
+	unsigned int textures;		// textures in the pool
+	size_t pooledBytes;			// memory of the textures in the pool
+	unsigned int invalidated;	// attachments invalidated
+	unsigned int created;		// textures and framebuffers made in the frame, 0 once warmed up
+};
+
+// A frame as a list of passes and the targets they read and write.
+// Passes and targets are declared from scratch every frame. A pass reading a target
+// runs after every pass writing it, passes writing the same target keep the order they
+// were added in. Passes that nothing in the output depends on are culled.
+// Targets made with create() live only from the first to the last pass using them;
+// they get textures from a pool, and targets whose lifetimes don't overlap share one.
+// Attachments are invalidated before the first pass writing them and after the last
+// pass using them, so the driver can skip loading and storing them (GL 4.3 or
+// ARB_invalidate_subdata). After a pass storing images there is a memory barrier.
+// All storage is fixed in size, building and running a frame never allocates; textures
+// and framebuffer objects are only made when the targets of a frame change.
+class RenderGraph{
+public:
+	RenderGraph();
+
+	// Must be called with a current GL context
+	void init();
+	void release();
+
+	// Forget the passes and targets of the last frame
+	void reset();
+	// A framebuffer drawn to outside the graph, e.g. 0 for the window. It is never invalidated
+	rg_resource import(const char *name, GLuint framebuffer, int width, int height);
+	// A texture living only in this frame, `format` is a sized internal format
+	rg_resource create(const char *name, int width, int height, GLenum format);
+	// `name` must stay valid, it also names the profiler scope of the pass
+	int addPass(const char *name, rg_execute execute, void *user);
+	// `pass` samples `resource` as a texture
+	void read(int pass, rg_resource resource);
+	// `pass` draws into `resource`, colors are attached in the order they are written
+	void write(int pass, rg_resource resource);
+	// `pass` writes `resource` as an image, e.g. from a compute shader. It is not attached,
+	// the pass binds it itself. Later passes can read it as a texture or blit from it
+	void store(int pass, rg_resource resource);
+	// What the frame is for, passes it doesn't depend on are culled
+	void output(rg_resource resource);
+	// Passes added until endGroup() also get a profiler scope around all of them
+	void beginGroup(const char *name) { group = name; }
+	void endGroup() { group = nullptr; }
+
+	// Order, cull and run the passes, with a GPU scope each if `profiler` is not null
+	void execute(GpuProfiler *profiler);
+
+	// For the passes while they run
+	GLuint texture(rg_resource resource) const;
+	// A framebuffer with only `resource` attached, e.g. to blit from
+	GLuint framebuffer(rg_resource resource);
+	int width(rg_resource resource) const { return resources[resource].width; }
+	int height(rg_resource resource) const { return resources[resource].height; }
+
+	const rg_stats &stats() const { return stat; }
+
+private:
+	struct resource_entry{
+		const char *name;
+		int width, height;
+		GLenum format;
+		GLuint framebuffer;		// imported
+		bool imported, output, needed;
+		int first, last;		// positions in the order of the first and last pass using it
+		int texture;			// pool entry, -1 before it is allocated
+	};
+	struct pass_entry{
+		const char *name;
+		const char *group;		// null outside of a group
+		rg_execute execute;
+		void *user;
+		rg_resource reads[RENDER_GRAPH_ACCESSES], writes[RENDER_GRAPH_ACCESSES];
+		int readCount, writeCount;
+		unsigned int stores;	// bit i: writes[i] is stored as an image, not attached
+		bool culled;
+	};
+	struct pool_texture{
+		GLuint texture;
+		int width, height;
+		GLenum format;
+		size_t bytes;
+		int busyUntil;			// position of the last pass using it in this frame, -1 when free
+		unsigned int lastFrame;	// last frame it was used
+	};
+	// Attachments in slots 0..RENDER_GRAPH_COLORS-1, depth and stencil in the last slot
+	struct framebuffer_entry{
+		GLuint framebuffer;
+		GLuint attachments[RENDER_GRAPH_COLORS+1];
+		unsigned int lastFrame;
+	};
+
+	bool sort();
+	void cull();
+	bool dependsOn(int pass, int other) const;
+	void acquireTargets(int position);
+	void releaseTargets(int position);
+	int findTexture(const resource_entry &resource);
+	GLuint findFramebuffer(const GLuint attachments[RENDER_GRAPH_COLORS+1], GLenum depthAttachment);
+	bool bindPass(const pass_entry &pass, GLuint &framebuffer);
+	void invalidate(const pass_entry &pass, int position, bool before);
+	void trimPool();
+
+	resource_entry resources[RENDER_GRAPH_RESOURCES];
+	pass_entry passes[RENDER_GRAPH_PASSES];
+	int order[RENDER_GRAPH_PASSES];		// passes in the order they run
+	int resourceCount, passCount;
+	const char *group;		// of the passes being added
+	pool_texture pool[RENDER_GRAPH_POOL];
+	framebuffer_entry framebuffers[RENDER_GRAPH_FRAMEBUFFERS];
+	int poolCount, framebufferCount;
+	size_t poolBytes;		// of all textures in the pool
+	unsigned int frame;
+	bool invalidateSupported;
+	bool warned;			// a limit was hit, only reported once
+	rg_stats stat;
+};
+
+#endif // RENDER_GRAPH_H
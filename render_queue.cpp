@@ -0,0 +1,83 @@
+#include "render_queue.h"
+#include "cpu_profiler.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+#define FIELD(value, bits, shift) ((uint64_t)((value) & ((1u << (bits)) - 1)) << (shift))
+
+void RenderQueue::push(render_pass pass, unsigned int program, unsigned int texture, unsigned int mesh, float depth, uint32_t object)
+{
+	if (depth < 0.0f)
+		depth = 0.0f;
+	if (depth > 1.0f)
+		depth = 1.0f;
+	unsigned int quantized = (unsigned int)(depth * ((1u << 20) - 1));
+
+	render_item item;
+	item.key = FIELD(pass, 4, 60) | FIELD(program, 12, 48) | FIELD(texture, 14, 34) |
+		FIELD(mesh, 14, 20) | FIELD(quantized, 20, 0);
+	item.object = object;
+	items.push_back(item);
+}
+
+void RenderQueue::sort()
+{
+	PROFILE_SCOPE("render queue sort");
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	size_t count = items.size();
+	// Nothing to sort, and the radix passes below read src[0]
+	if (count < 2) {
+		sortTime = 0.0;
+		return;
+	}
+	scratch.resize(count);
+
+	render_item *src = items.data(), *dst = scratch.data();
+	for (int shift=0;shift<64;shift+=8) {
+		size_t histogram[256] = {0};
+		for (size_t i=0;i<count;i++)
+			histogram[(src[i].key >> shift) & 0xFF]++;
+
+		// Nothing to do if every key has the same byte here
+		if (histogram[(src[0].key >> shift) & 0xFF] == count)
+			continue;
+
+		size_t offset = 0;
+		for (int b=0;b<256;b++) {
+			size_t n = histogram[b];
+			histogram[b] = offset;
+			offset += n;
+		}
+		for (size_t i=0;i<count;i++)
+			dst[histogram[(src[i].key >> shift) & 0xFF]++] = src[i];
+		std::swap(src, dst);
+	}
+	if (src != items.data())
+		items.swap(scratch);
+
+	sortTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-begin).count();
+}
+
+void benchmark_render_queue()
+{
+	RenderQueue queue;
+	size_t sizes[] = {1000, 10000, 100000};
+	for (int s=0;s<3;s++) {
+		// A few programs and textures shared by many draws, like a real scene
+		double total = 0.0;
+		int runs = 20;
+		for (int r=0;r<runs;r++) {
+			queue.clear();
+			for (size_t i=0;i<sizes[s];i++)
+				queue.push(PASS_OPAQUE, 1+rand()%4, 1+rand()%16, 1+rand()%32, rand()/(float)RAND_MAX, i);
+			queue.sort();
+			total += queue.lastSortTime();
+		}
+		for (size_t i=1;i<queue.size();i++)
+			if (queue[i-1].key > queue[i].key)
+				printf("Render queue is not sorted!\n");
+		printf("Render queue: %zu draws sorted in %.3f ms\n", sizes[s], total/runs);
+	}
+}
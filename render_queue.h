@@ -0,0 +1,47 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Order of passes in the sort key
+enum render_pass{ PASS_OPAQUE = 0, PASS_TRANSPARENT = 1, PASS_OVERLAY = 2 };
+
+struct render_item{
+	uint64_t key;
+	uint32_t object;		// index of the object to draw
+};
+
+// Every draw of a frame is encoded as a 64-bit key and radix sorted, so draws
+// sharing program, texture and mesh end up next to each other:
+//   bits 60-63 pass | 48-59 program | 34-47 texture | 20-33 mesh | 0-19 depth
+// Names are truncated to their field; a collision only changes the order, never what is drawn.
+// Opaque draws are sorted front to back inside the same state.
+class RenderQueue{
+public:
+	RenderQueue(): sortTime(0.0) {}
+
+	void clear() { items.clear(); }
+	// Make room for `count` draws, so a frame with no more than that never allocates
+	void reserve(size_t count) { items.reserve(count); scratch.reserve(count); }
+	// `depth` is the view distance divided by the far plane, clamped to [0, 1]
+	void push(render_pass pass, unsigned int program, unsigned int texture, unsigned int mesh, float depth, uint32_t object);
+	// LSD radix sort, 8 bits per pass, passes where all keys share the byte are skipped
+	void sort();
+
+	size_t size() const { return items.size(); }
+	const render_item &operator[](size_t i) const { return items[i]; }
+
+	double lastSortTime() const { return sortTime; }	// milliseconds
+
+private:
+	std::vector<render_item> items;
+	std::vector<render_item> scratch;
+	double sortTime;
+};
+
+// Sort random queues of several sizes and print the time
+void benchmark_render_queue();
+
+#endif // RENDER_QUEUE_H
@@ -0,0 +1,168 @@
+#include "scene_graph.h"
+#include "cpu_profiler.h"
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+
+int SceneGraph::add(int parent)
+{
+	int handle = slots.size();
+	int index = parents.size();
+	slots.push_back(index);
+	handles.push_back(handle);
+	parents.push_back(parent == NO_PARENT ? NO_PARENT : slots[parent]);
+	depths.push_back(parent == NO_PARENT ? 0 : depths[slots[parent]]+1);
+	translations.push_back(glm::vec3(0.0f));
+	rotations.push_back(glm::quat());
+	scales.push_back(glm::vec3(1.0f));
+	worlds.push_back(glm::mat4(1.0f));
+	dirty.push_back(1);
+	// Appending keeps parents in front of children, but not the depth order
+	if (index > 0 && depths[index] < depths[index-1])
+		reorder = true;
+	return handle;
+}
+
+void SceneGraph::setTranslation(int node, const glm::vec3 &translation)
+{
+	translations[slots[node]] = translation;
+	dirty[slots[node]] = 1;
+}
+
+void SceneGraph::setRotation(int node, const glm::quat &rotation)
+{
+	rotations[slots[node]] = rotation;
+	dirty[slots[node]] = 1;
+}
+
+void SceneGraph::setScale(int node, const glm::vec3 &scale)
+{
+	scales[slots[node]] = scale;
+	dirty[slots[node]] = 1;
+}
+
+// Move every array into depth order, fix parent indices and slots
+void SceneGraph::sortByDepth()
+{
+	size_t count = parents.size();
+	std::vector<int> order(count);
+	for (size_t i=0;i<count;i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [this](int a, int b) { return depths[a] < depths[b]; });
+
+	std::vector<int> newIndex(count);
+	for (size_t i=0;i<count;i++)
+		newIndex[order[i]] = i;
+
+	std::vector<int> newParents(count), newDepths(count), newHandles(count);
+	std::vector<glm::vec3> newTranslations(count), newScales(count);
+	std::vector<glm::quat> newRotations(count);
+	std::vector<glm::mat4> newWorlds(count);
+	std::vector<unsigned char> newDirty(count);
+	for (size_t i=0;i<count;i++) {
+		int old = order[i];
+		newParents[i] = parents[old] == NO_PARENT ? NO_PARENT : newIndex[parents[old]];
+		newDepths[i] = depths[old];
+		newHandles[i] = handles[old];
+		newTranslations[i] = translations[old];
+		newRotations[i] = rotations[old];
+		newScales[i] = scales[old];
+		newWorlds[i] = worlds[old];
+		newDirty[i] = dirty[old];
+		slots[handles[old]] = i;
+	}
+	parents.swap(newParents);
+	depths.swap(newDepths);
+	handles.swap(newHandles);
+	translations.swap(newTranslations);
+	rotations.swap(newRotations);
+	scales.swap(newScales);
+	worlds.swap(newWorlds);
+	dirty.swap(newDirty);
+	reorder = false;
+}
+
+void SceneGraph::update()
+{
+	PROFILE_SCOPE("scene graph update");
+	if (reorder)
+		sortByDepth();
+
+	// A parent is always in front of its children, so its world matrix and dirty
+	// flag are final when the children are reached. The flag of a recomputed node
+	// stays set until the end, so its children see that they must follow
+	updated = 0;
+	size_t count = parents.size();
+	for (size_t i=0;i<count;i++) {
+		int parent = parents[i];
+		if (!dirty[i] && (parent == NO_PARENT || !dirty[parent]))
+			continue;
+		glm::mat4 local = glm::translate(glm::mat4(1.0f), translations[i]) * glm::mat4_cast(rotations[i]);
+		local[0] *= scales[i].x;
+		local[1] *= scales[i].y;
+		local[2] *= scales[i].z;
+		worlds[i] = (parent == NO_PARENT) ? local : worlds[parent] * local;
+		dirty[i] = 1;
+		updated++;
+	}
+	std::fill(dirty.begin(), dirty.end(), 0);
+}
+
+static double elapsed(std::chrono::steady_clock::time_point begin)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-begin).count();
+}
+
+void benchmark_scene_graph()
+{
+	// A sun, 1000 planets with 9 moons each, and every planet and moon carries
+	// 9 static nodes (rings, stations, ...): 1 + 1000*10*10 = 100001 nodes.
+	// Only planets and moons move, and only some of them in each frame
+	SceneGraph graph;
+	int sun = graph.add(NO_PARENT);
+	std::vector<int> bodies;
+	for (int p=0;p<1000;p++) {
+		int planet = graph.add(sun);
+		graph.setTranslation(planet, glm::vec3(10.0f+p, 0.0f, 0.0f));
+		bodies.push_back(planet);
+		for (int d=0;d<9;d++)
+			graph.add(planet);
+		for (int m=0;m<9;m++) {
+			int moon = graph.add(planet);
+			graph.setTranslation(moon, glm::vec3(1.0f+m, 0.0f, 0.0f));
+			bodies.push_back(moon);
+			for (int d=0;d<9;d++)
+				graph.add(moon);
+		}
+	}
+	graph.update();
+	printf("Scene graph: %zu nodes\n", graph.size());
+
+	int runs = 100;
+	int strides[] = {0, 1000, 100, 10, 1};		// every n-th body moves, 0 for none
+	for (int s=0;s<5;s++) {
+		double total = 0.0;
+		size_t updated = 0;
+		for (int r=0;r<runs;r++) {
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			if (strides[s])
+				for (size_t b=r%strides[s];b<bodies.size();b+=strides[s])
+					graph.setRotation(bodies[b], glm::angleAxis(r*0.01f, glm::vec3(0.0f, 1.0f, 0.0f)));
+			graph.update();
+			total += elapsed(begin);
+			updated += graph.lastUpdated();
+		}
+		printf("Scene graph: %5.1f%% of bodies moving, %6zu nodes recomputed, update %.3f ms\n",
+				strides[s] ? 100.0/strides[s] : 0.0, updated/runs, total/runs);
+	}
+	// Everything recomputed every time, as if there were no dirty flags
+	double total = 0.0;
+	for (int r=0;r<runs;r++) {
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		graph.setRotation(0, glm::angleAxis(r*0.01f, glm::vec3(0.0f, 1.0f, 0.0f)));
+		graph.update();
+		total += elapsed(begin);
+	}
+	printf("Scene graph: full recompute of %zu nodes %.3f ms\n", graph.size(), total/runs);
+}
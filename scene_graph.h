@@ -0,0 +1,58 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <vector>
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Root nodes have this parent
+#define NO_PARENT -1
+
+// Hierarchy of transform nodes. Every node has a local translation, rotation and
+// scale and a cached world matrix (world of the parent * local).
+// Nodes are stored in flat arrays ordered by depth, so update() is one pass from
+// front to back in which every parent comes before its children. Only nodes whose
+// local transform changed, and their subtrees, are recomputed.
+// Nodes are referred to by handles, which stay valid when the arrays are reordered.
+class SceneGraph{
+public:
+	SceneGraph(): reorder(false), updated(0) {}
+
+	// Add a node below `parent` (NO_PARENT for a root), returns its handle
+	int add(int parent);
+	size_t size() const { return parents.size(); }
+
+	void setTranslation(int node, const glm::vec3 &translation);
+	void setRotation(int node, const glm::quat &rotation);
+	void setScale(int node, const glm::vec3 &scale);
+	// World matrix as of the last update()
+	const glm::mat4 &world(int node) const { return worlds[slots[node]]; }
+
+	// Recompute the world matrices of changed subtrees
+	void update();
+	// Nodes recomputed by the last update()
+	size_t lastUpdated() const { return updated; }
+
+private:
+	void sortByDepth();
+
+	// Per node, in depth order
+	std::vector<int> parents;			// index of the parent, NO_PARENT for roots
+	std::vector<int> depths;
+	std::vector<int> handles;			// handle of the node at this index
+	std::vector<glm::vec3> translations;
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> scales;
+	std::vector<glm::mat4> worlds;
+	std::vector<unsigned char> dirty;	// local transform changed, or world must be recomputed
+
+	std::vector<int> slots;				// index of every handle
+	bool reorder;						// nodes were added since the last update()
+	size_t updated;
+};
+
+// Update a 100k node solar system with mostly static nodes and print the time
+void benchmark_scene_graph();
+
+#endif // SCENE_GRAPH_H
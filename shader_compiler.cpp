@@ -0,0 +1,230 @@
+#include "shader_compiler.h"
+#include "cpu_profiler.h"
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+
+// Token values are the same in the KHR and ARB extension
+#ifndef GL_COMPLETION_STATUS_KHR
+	#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+static double now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool hasExtension(const char *name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i=0;i<count;i++)
+		if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+			return true;
+	return false;
+}
+
+// Print the info log of a shader or program
+static void printLog(const char *title, const std::string &name, unsigned int object, bool isProgram)
+{
+	int maxLength = 0;
+	if (isProgram)
+		glGetProgramiv(object, GL_INFO_LOG_LENGTH, &maxLength);
+	else
+		glGetShaderiv(object, GL_INFO_LOG_LENGTH, &maxLength);
+
+	/* The maxLength includes the NULL character */
+	char *infoLog = new char[maxLength+1];
+	infoLog[0] = '\0';
+	if (isProgram)
+		glGetProgramInfoLog(object, maxLength+1, nullptr, infoLog);
+	else
+		glGetShaderInfoLog(object, maxLength+1, nullptr, infoLog);
+	fprintf(stderr, "%s (%s): %s\n", title, name.c_str(), infoLog);
+	delete [] infoLog;
+}
+
+ShaderCompiler::ShaderCompiler(ProgramCache &cache): cache(cache), parallelCompile(false)
+{
+}
+
+void ShaderCompiler::init()
+{
+	if (GLEW_ARB_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);	// let the driver choose
+		parallelCompile = true;
+	}
+	else
+		parallelCompile = hasExtension("GL_KHR_parallel_shader_compile");
+}
+
+unsigned int ShaderCompiler::submit(const std::string &name, const std::string &vertex_shader, const std::string &fragment_shader)
+{
+	return submit(name, vertex_shader, fragment_shader, false);
+}
+
+// The cache key of a compute program has no vertex source, so it is never taken for another program
+unsigned int ShaderCompiler::submitCompute(const std::string &name, const std::string &compute_shader)
+{
+	return submit(name, "", compute_shader, true);
+}
+
+unsigned int ShaderCompiler::submit(const std::string &name, const std::string &vertex_shader, const std::string &fragment_shader, bool compute)
+{
+	program_job job;
+	job.name = name;
+	job.vsSource = vertex_shader;
+	job.fsSource = fragment_shader;
+	job.vs = job.fs = 0;
+	job.compute = compute;
+	job.submitTime = now();
+	job.buildTime = 0.0;
+	job.cached = false;
+	job.done = false;
+	job.failed = false;
+
+	// Binary from cache is already linked
+	job.program = cache.load(vertex_shader, fragment_shader);
+	if (job.program) {
+		job.done = true;
+		job.cached = true;
+		job.buildTime = (now()-job.submitTime)*1000.0;
+		printf("%s program: cache load %.2f ms\n", name.c_str(), job.buildTime);
+		jobs.push_back(job);
+		return job.program;
+	}
+
+	// Only issue the work here, every status query is left to finish()
+	const char *source = vertex_shader.c_str();
+	if (!compute) {
+		job.vs = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(job.vs, 1, &source, nullptr);
+		glCompileShader(job.vs);
+	}
+
+	source = fragment_shader.c_str();
+	job.fs = glCreateShader(compute ? GL_COMPUTE_SHADER : GL_FRAGMENT_SHADER);
+	glShaderSource(job.fs, 1, &source, nullptr);
+	glCompileShader(job.fs);
+
+	job.program = glCreateProgram();
+	if (!compute)
+		glAttachShader(job.program, job.vs);
+	glAttachShader(job.program, job.fs);
+	// Tell the driver we will ask for the binary later
+	if (cache.enabled())
+		glProgramParameteri(job.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(job.program);
+
+	jobs.push_back(job);
+	return job.program;
+}
+
+// The latest job first: a program which failed is deleted, and GL may give its name to a later one
+ShaderCompiler::program_job *ShaderCompiler::find(unsigned int program)
+{
+	for (size_t i=jobs.size();i>0;i--)
+		if (jobs[i-1].program == program)
+			return &jobs[i-1];
+	return nullptr;
+}
+
+bool ShaderCompiler::isReady(const program_job &job) const
+{
+	if (job.done)
+		return true;
+	if (!parallelCompile)
+		return false;
+	int status = GL_FALSE;
+	glGetProgramiv(job.program, GL_COMPLETION_STATUS_KHR, &status);
+	return status == GL_TRUE;
+}
+
+// Check the result of compiling and linking, this blocks if the driver is still working
+bool ShaderCompiler::finish(program_job &job)
+{
+	if (job.done)
+		return !job.failed;
+	job.done = true;
+	PROFILE_SCOPE("shader finish");
+
+	int status;
+	glGetProgramiv(job.program, GL_LINK_STATUS, &status);
+	if (status == GL_FALSE) {
+		// Find out which stage is wrong
+		if (!job.compute) {
+			glGetShaderiv(job.vs, GL_COMPILE_STATUS, &status);
+			if (status == GL_FALSE)
+				printLog("Vertex Shader Error", job.name, job.vs, false);
+		}
+		glGetShaderiv(job.fs, GL_COMPILE_STATUS, &status);
+		if (status == GL_FALSE)
+			printLog(job.compute ? "Compute Shader Error" : "Fragment Shader Error", job.name, job.fs, false);
+		printLog("Link Error", job.name, job.program, true);
+		job.failed = true;
+		glDeleteProgram(job.program);
+	}
+
+	// No more need to be used, delete it
+	glDeleteShader(job.vs);
+	glDeleteShader(job.fs);
+	job.vs = job.fs = 0;
+
+	if (job.failed)
+		return false;
+	job.buildTime = (now()-job.submitTime)*1000.0;
+	printf("%s program: compile %.2f ms\n", job.name.c_str(), job.buildTime);
+	cache.save(job.program, job.vsSource, job.fsSource);
+	// Sources are not needed anymore
+	std::string().swap(job.vsSource);
+	std::string().swap(job.fsSource);
+	return true;
+}
+
+unsigned int ShaderCompiler::require(unsigned int program)
+{
+	program_job *job = find(program);
+	if (job == nullptr)
+		return program;
+	return finish(*job) ? program : 0;
+}
+
+void ShaderCompiler::poll()
+{
+	for (size_t i=0;i<jobs.size();i++) {
+		if (jobs[i].done)
+			continue;
+		if (isReady(jobs[i]))
+			finish(jobs[i]);
+		else if (!parallelCompile) {
+			// Driver compiles on this thread, so only do one program per frame
+			finish(jobs[i]);
+			break;
+		}
+	}
+}
+
+double ShaderCompiler::buildTime(unsigned int program) const
+{
+	for (size_t i=0;i<jobs.size();i++)
+		if (jobs[i].program == program)
+			return jobs[i].buildTime;
+	return 0.0;
+}
+
+bool ShaderCompiler::fromCache(unsigned int program) const
+{
+	for (size_t i=0;i<jobs.size();i++)
+		if (jobs[i].program == program)
+			return jobs[i].cached;
+	return false;
+}
+
+int ShaderCompiler::pending() const
+{
+	int count = 0;
+	for (size_t i=0;i<jobs.size();i++)
+		if (!jobs[i].done)
+			count++;
+	return count;
+}
@@ -0,0 +1,62 @@
+#ifndef SHADER_COMPILER_H
+#define SHADER_COMPILER_H
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include "program_cache.h"
+
+// Compile programs without waiting for the driver.
+// submit() hands all sources to the driver at once and returns the program name
+// right away. Status is only checked when the program is needed (require()), or
+// in the background by poll() once the driver says it is done.
+// With KHR/ARB_parallel_shader_compile the driver compiles on its own threads;
+// without it, poll() finishes one pending program per frame.
+class ShaderCompiler{
+public:
+	ShaderCompiler(ProgramCache &cache);
+
+	// Must be called with a current GL context
+	void init();
+	bool parallel() const { return parallelCompile; }
+
+	// Start building a program, returns its name (0 if it cannot be created)
+	unsigned int submit(const std::string &name, const std::string &vertex_shader, const std::string &fragment_shader);
+	// The same for a compute program (GL 4.3)
+	unsigned int submitCompute(const std::string &name, const std::string &compute_shader);
+	// Block until the program is linked. Returns 0 if compiling or linking failed,
+	// the program is deleted then
+	unsigned int require(unsigned int program);
+	// Finish programs which are done in the background, call it once per frame
+	void poll();
+	// Number of programs not finished yet
+	int pending() const;
+	// Milliseconds from submit() to finished, and if the binary came from the cache
+	double buildTime(unsigned int program) const;
+	bool fromCache(unsigned int program) const;
+
+private:
+	struct program_job{
+		std::string name;
+		std::string vsSource, fsSource;	// a compute program has only fsSource
+		unsigned int program;
+		unsigned int vs, fs;			// the compute shader is in fs
+		bool compute;
+		double submitTime;
+		double buildTime;
+		bool cached;
+		bool done;
+		bool failed;
+	};
+
+	unsigned int submit(const std::string &name, const std::string &vertex_shader, const std::string &fragment_shader, bool compute);
+	bool finish(program_job &job);
+	bool isReady(const program_job &job) const;
+	program_job *find(unsigned int program);
+
+	ProgramCache &cache;
+	std::vector<program_job> jobs;
+	bool parallelCompile;
+};
+
+#endif // SHADER_COMPILER_H
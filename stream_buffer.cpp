@@ -0,0 +1,146 @@
+#include "stream_buffer.h"
+#include "cpu_profiler.h"
+#include <chrono>
+#include <cstdio>
+
+// Smallest region, so a small scene never reallocates
+#define MIN_REGION_SIZE (256*1024)
+
+static double now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+StreamBuffer::StreamBuffer(): name(0), created(0), mapped(nullptr), regionSize(0), region(0), head(0), warned(false)
+{
+	for (int i=0;i<STREAM_FRAMES;i++)
+		fences[i] = 0;
+	resetStats();
+}
+
+void StreamBuffer::resetStats()
+{
+	stat.stalls = 0;
+	stat.stallTime = 0.0;
+	stat.resizes = 0;
+}
+
+void StreamBuffer::init()
+{
+	create(MIN_REGION_SIZE);
+}
+
+void StreamBuffer::release()
+{
+	destroy();
+}
+
+void StreamBuffer::create(size_t regionBytes)
+{
+	regionSize = regionBytes;
+	region = 0;
+	head = 0;
+	created++;
+	glGenBuffers(1, &name);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, name);
+	if (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, regionSize*STREAM_FRAMES, nullptr, flags);
+		mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, regionSize*STREAM_FRAMES, flags);
+		if (mapped == nullptr) {
+			// Storage is immutable, start again with a new buffer
+			glDeleteBuffers(1, &name);
+			glGenBuffers(1, &name);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, name);
+		}
+	}
+	if (mapped == nullptr) {
+		glBufferData(GL_COPY_WRITE_BUFFER, regionSize, nullptr, GL_STREAM_DRAW);
+		staging.resize(regionSize);
+	}
+}
+
+void StreamBuffer::destroy()
+{
+	// Nothing may still read the buffer
+	for (int i=0;i<STREAM_FRAMES;i++) {
+		if (fences[i]) {
+			glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			glDeleteSync(fences[i]);
+			fences[i] = 0;
+		}
+	}
+	if (mapped) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, name);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		mapped = nullptr;
+	}
+	glDeleteBuffers(1, &name);
+	name = 0;
+	std::vector<unsigned char>().swap(staging);
+}
+
+void StreamBuffer::beginFrame(size_t bytes)
+{
+	PROFILE_SCOPE("stream buffer wait");
+	if (bytes > regionSize) {
+		size_t size = regionSize;
+		while (size < bytes)
+			size *= 2;
+		destroy();
+		create(size);
+		stat.resizes++;
+	}
+
+	head = 0;
+	if (!mapped)
+		return;
+	region = (region+1) % STREAM_FRAMES;
+	GLsync &fence = fences[region];
+	if (fence == 0)
+		return;
+	// The GPU has not finished the frame which used this region STREAM_FRAMES frames ago
+	if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+		double start = now();
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+			;
+		stat.stalls++;
+		stat.stallTime += (now()-start)*1000.0;
+	}
+	glDeleteSync(fence);
+	fence = 0;
+}
+
+void *StreamBuffer::allocate(size_t size, size_t align, size_t &offset)
+{
+	size_t base = mapped ? region*regionSize : 0;
+	// Offsets in the buffer must be aligned, not only inside the region
+	size_t start = (base + head + align - 1) / align * align;
+	head = start - base + size;
+	offset = start;
+	if (head > regionSize) {
+		// beginFrame was told too little
+		if (!warned)
+			fprintf(stderr, "Stream buffer: a frame needs more than %u bytes, uploads are skipped\n", (unsigned int)regionSize);
+		warned = true;
+		head = start - base;
+		return nullptr;
+	}
+	return mapped ? mapped+start : staging.data()+(start-base);
+}
+
+void StreamBuffer::commit()
+{
+	if (mapped || head == 0)
+		return;
+	// Orphan the old storage, so we don't wait for the last frame to finish with it
+	glBindBuffer(GL_COPY_WRITE_BUFFER, name);
+	glBufferData(GL_COPY_WRITE_BUFFER, regionSize, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, 0, head, staging.data());
+}
+
+void StreamBuffer::endFrame()
+{
+	if (mapped)
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
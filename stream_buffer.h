@@ -0,0 +1,67 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <GL/glew.h>
+#include <vector>
+
+// Number of frames the CPU may write ahead of the GPU
+#define STREAM_FRAMES 3
+
+struct stream_stats{
+	unsigned int stalls;		// frames which had to wait for the GPU
+	double stallTime;			// milliseconds spent waiting
+	unsigned int resizes;		// times the ring was reallocated
+};
+
+// Ring buffer for data written by the CPU every frame (uniform blocks, instances,
+// indirect commands). With GL 4.4 or ARB_buffer_storage it is one persistently and
+// coherently mapped buffer split into STREAM_FRAMES regions, each guarded by a fence,
+// so the data is written straight into memory the GPU reads.
+// Otherwise there is one region in system memory, uploaded with orphaning in commit().
+class StreamBuffer{
+public:
+	StreamBuffer();
+
+	void init();
+	void release();
+	bool persistent() const { return mapped != nullptr; }
+
+	// Start writing a frame of at most `bytes` bytes, count `align` extra bytes for
+	// every allocation.
+	// Waits if the GPU still reads the region, the ring grows if it is too small
+	void beginFrame(size_t bytes);
+	// Reserve `size` bytes at a multiple of `align` (any value, not only powers of two).
+	// Returns where to write them, `offset` is set to their offset in buffer().
+	// Returns nullptr if they don't fit into the bytes given to beginFrame, callers skip their upload then
+	void *allocate(size_t size, size_t align, size_t &offset);
+	// Make the written data visible to GL, call it before the draws of the frame
+	void commit();
+	// Call it after the last draw which reads this frame's data
+	void endFrame();
+
+	GLuint buffer() const { return name; }
+	// Changes whenever the buffer is created again. The new buffer may get the name of
+	// the deleted one, so anything set up for a buffer compares this, not the name
+	unsigned int generation() const { return created; }
+	// Bytes of buffer memory the ring takes
+	size_t bytes() const { return mapped ? regionSize*STREAM_FRAMES : regionSize; }
+	const stream_stats &stats() const { return stat; }
+	void resetStats();
+
+private:
+	void create(size_t regionBytes);
+	void destroy();
+
+	GLuint name;
+	unsigned int created;			// buffers made by create()
+	unsigned char *mapped;			// persistent mapping of the whole ring
+	std::vector<unsigned char> staging;	// system memory region without buffer storage
+	GLsync fences[STREAM_FRAMES];
+	size_t regionSize;
+	int region;						// region written in this frame
+	size_t head;					// bytes used in the region
+	bool warned;					// an allocation did not fit, only reported once
+	stream_stats stat;
+};
+
+#endif // STREAM_BUFFER_H
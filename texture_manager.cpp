@@ -0,0 +1,212 @@
+#include "texture_manager.h"
+#include "gl_state.h"
+#include "cpu_profiler.h"
+#include <cstring>
+#include <algorithm>
+
+// A texture is thrown out instead of demoted once it is this small
+#define MIN_RESIDENT_SIZE 16
+
+TextureManager::TextureManager(unsigned long long budgetBytes): load(nullptr), frame(0)
+{
+	memset(&stat, 0, sizeof(stat));
+	stat.budgetBytes = budgetBytes;
+}
+
+void TextureManager::setBudget(unsigned long long budgetBytes)
+{
+	stat.budgetBytes = budgetBytes;
+}
+
+// Size of `level` of a texture, at least 1x1
+static unsigned int levelSize(unsigned int size, int level)
+{
+	return std::max(size >> level, 1u);
+}
+
+// Bytes of the levels of a RGBA8 texture from `dropLevel` down to 1x1, 0 when it is evicted
+unsigned long long TextureManager::chainBytes(const texture_entry &entry, int dropLevel)
+{
+	unsigned long long bytes = 0;
+	for (int level=dropLevel;level<entry.levels;level++)
+		bytes += (unsigned long long)levelSize(entry.width, level)*levelSize(entry.height, level)*4;
+	return bytes;
+}
+
+// The first level no larger than MIN_RESIDENT_SIZE on either side
+int TextureManager::residentLevel(const texture_entry &entry)
+{
+	int level = 0;
+	while (level < entry.levels-1 && ((entry.width >> level) > MIN_RESIDENT_SIZE || (entry.height >> level) > MIN_RESIDENT_SIZE))
+		level++;
+	return level;
+}
+
+void TextureManager::add(GLuint texture, const char *path)
+{
+	PROFILE_SCOPE("texture add");
+	remove(texture);
+
+	texture_entry entry;
+	entry.path = path;
+	entry.width = entry.height = 0;
+	entry.levels = entry.dropLevel = 0;
+	entry.bytes = 0;
+	entry.lastUsed = frame;
+	texture_entry &node = entries[texture] = entry;
+	if (!upload(texture, node)) {
+		entries.erase(texture);
+		return;
+	}
+	stat.textures = entries.size();
+	enforce();
+}
+
+// Load the file of `entry` into `texture` with its full mip chain, false if it can't be read
+bool TextureManager::upload(GLuint texture, texture_entry &entry)
+{
+	if (load == nullptr)
+		return false;
+	unsigned int width, height;
+	unsigned short int bits;
+	unsigned char *bgr = load(entry.path.c_str(), &width, &height, &bits);
+	if (bgr == nullptr || width == 0 || height == 0) {
+		delete [] bgr;
+		return false;
+	}
+	entry.width = width;
+	entry.height = height;
+	entry.levels = 1;
+	while ((std::max(width, height) >> entry.levels) > 0)
+		entry.levels++;
+
+	// Rows of bmps are padded to 4 bytes, which is the default unpack alignment
+	glState.editTexture(texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, bits == 32 ? GL_BGRA : GL_BGR, GL_UNSIGNED_BYTE, bgr);
+	delete [] bgr;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry.levels-1);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	account(entry, 0);
+	return true;
+}
+
+void TextureManager::remove(GLuint texture)
+{
+	std::map<GLuint, texture_entry>::iterator it = entries.find(texture);
+	if (it == entries.end())
+		return;
+	stat.usedBytes -= it->second.bytes;
+	entries.erase(it);
+	stat.textures = entries.size();
+}
+
+void TextureManager::clear()
+{
+	entries.clear();
+	stat.usedBytes = 0;
+	stat.textures = 0;
+}
+
+void TextureManager::beginFrame()
+{
+	frame++;
+}
+
+void TextureManager::use(GLuint texture)
+{
+	std::map<GLuint, texture_entry>::iterator it = entries.find(texture);
+	if (it == entries.end())
+		return;
+	texture_entry &entry = it->second;
+	entry.lastUsed = frame;
+	if (entry.dropLevel == 0)
+		return;
+
+	// As many levels back as fit, enforce() would only drop them again otherwise.
+	// An evicted texture is drawn now, so it comes back at MIN_RESIDENT_SIZE at least
+	int level = (entry.dropLevel == entry.levels) ? residentLevel(entry) : entry.dropLevel;
+	unsigned long long others = stat.usedBytes-entry.bytes;
+	while (level > 0 && (stat.budgetBytes == 0 || others+chainBytes(entry, level-1) <= stat.budgetBytes))
+		level--;
+	if (level == entry.dropLevel)
+		return;
+	// The file is loaded again and shrunk to the levels that fit
+	if (!upload(texture, entry))
+		return;
+	if (level > 0)
+		shrink(texture, entry, level);
+	stat.restores++;
+}
+
+void TextureManager::enforce()
+{
+	if (stat.budgetBytes == 0)
+		return;
+	while (stat.usedBytes > stat.budgetBytes) {
+		// The least recently drawn texture which is still allocated. Textures drawn
+		// in this frame come last and keep at least MIN_RESIDENT_SIZE
+		std::map<GLuint, texture_entry>::iterator victim = entries.end();
+		for (std::map<GLuint, texture_entry>::iterator it=entries.begin();it!=entries.end();++it) {
+			const texture_entry &entry = it->second;
+			if (entry.dropLevel == entry.levels)
+				continue;
+			bool small = (entry.width >> entry.dropLevel) <= MIN_RESIDENT_SIZE && (entry.height >> entry.dropLevel) <= MIN_RESIDENT_SIZE;
+			if (entry.lastUsed >= frame && small)
+				continue;
+			if (victim == entries.end() || entry.lastUsed < victim->second.lastUsed)
+				victim = it;
+		}
+		if (victim == entries.end())
+			break;
+
+		texture_entry &entry = victim->second;
+		unsigned int width = entry.width >> entry.dropLevel;
+		unsigned int height = entry.height >> entry.dropLevel;
+		if (width <= MIN_RESIDENT_SIZE && height <= MIN_RESIDENT_SIZE) {
+			shrink(victim->first, entry, entry.levels);
+			stat.evictions++;
+		}
+		else {
+			shrink(victim->first, entry, entry.dropLevel+1);
+			stat.demotions++;
+		}
+	}
+}
+
+// Keep the levels of the file from `dropLevel` down. They are read back and uploaded again
+// as levels 0.. of `texture`, and the levels past them are specified empty, which releases
+// their storage. With `dropLevel` equal to the levels nothing is kept
+void TextureManager::shrink(GLuint texture, texture_entry &entry, int dropLevel)
+{
+	PROFILE_SCOPE("texture shrink");
+	glState.editTexture(texture);
+	readback.resize(chainBytes(entry, dropLevel));
+	size_t offset = 0;
+	for (int level=dropLevel;level<entry.levels;level++) {
+		glGetTexImage(GL_TEXTURE_2D, level-entry.dropLevel, GL_RGBA, GL_UNSIGNED_BYTE, readback.data()+offset);
+		offset += (size_t)levelSize(entry.width, level)*levelSize(entry.height, level)*4;
+	}
+	offset = 0;
+	for (int level=dropLevel;level<entry.levels;level++) {
+		unsigned int width = levelSize(entry.width, level), height = levelSize(entry.height, level);
+		glTexImage2D(GL_TEXTURE_2D, level-dropLevel, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, readback.data()+offset);
+		offset += (size_t)width*height*4;
+	}
+	for (int level=entry.levels-dropLevel;level<entry.levels-entry.dropLevel;level++)
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, std::max(entry.levels-dropLevel-1, 0));
+	account(entry, dropLevel);
+}
+
+// Count the levels of `entry` from `dropLevel` down as allocated
+void TextureManager::account(texture_entry &entry, int dropLevel)
+{
+	stat.usedBytes -= entry.bytes;
+	entry.bytes = chainBytes(entry, dropLevel);
+	entry.dropLevel = dropLevel;
+	stat.usedBytes += entry.bytes;
+	if (stat.usedBytes > stat.peakBytes)
+		stat.peakBytes = stat.usedBytes;
+}
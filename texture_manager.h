@@ -0,0 +1,76 @@
+#ifndef TEXTURE_MANAGER_H
+#define TEXTURE_MANAGER_H
+
+#include <GL/glew.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// Counters exposed for monitoring
+struct texture_stats{
+	unsigned long long usedBytes;		// VRAM allocated for all managed textures (mips included)
+	unsigned long long budgetBytes;		// 0 means unlimited
+	unsigned long long peakBytes;
+	unsigned int textures;				// managed textures
+	unsigned int demotions;				// times a texture was shrunk to a lower mip
+	unsigned int evictions;				// times a texture was released entirely
+	unsigned int restores;				// times a drawn texture was loaded again with more levels
+};
+
+// Reads the pixels of a texture file (24 or 32 bits, bottom-up rows), freed with delete []
+typedef unsigned char *(*texture_loader)(const char *path, unsigned int *width, unsigned int *height, unsigned short int *bits);
+
+// Keep textures inside a VRAM budget.
+// Every texture is uploaded with its full mip chain. When the budget is exceeded, the least
+// recently drawn texture is shrunk one level at a time: the levels it keeps are read back and
+// uploaded again as levels 0.., and the storage of the largest level is released. Once it is
+// down to MIN_RESIDENT_SIZE it is released entirely. Textures drawn in the current frame are
+// only demoted after all others are evicted, and never below MIN_RESIDENT_SIZE.
+// A drawn texture gets levels back when the budget has room, by loading its file again.
+// The GL texture name never changes, so objects can keep their handle.
+class TextureManager{
+public:
+	TextureManager(unsigned long long budgetBytes = 0);
+
+	void setBudget(unsigned long long budgetBytes);
+	// Must be set before add()
+	void setLoader(texture_loader loader) { load = loader; }
+
+	// Load the file `path` into `texture` and manage it
+	void add(GLuint texture, const char *path);
+	void remove(GLuint texture);
+	void clear();
+
+	// Call once at the beginning of every frame
+	void beginFrame();
+	// Call before a texture is drawn, it gets levels back if the budget has room
+	void use(GLuint texture);
+	// Shrink least recently drawn textures until usage fits the budget
+	void enforce();
+
+	const texture_stats &stats() const { return stat; }
+
+private:
+	struct texture_entry{
+		std::string path;
+		unsigned int width, height;			// size of level 0 of the file
+		int levels;							// in the full mip chain, the last one is 1x1
+		int dropLevel;						// level of the file in level 0 of the texture, levels means evicted
+		unsigned long long bytes;			// allocated for the levels kept
+		unsigned long long lastUsed;		// last frame this texture was drawn
+	};
+
+	bool upload(GLuint texture, texture_entry &entry);
+	void shrink(GLuint texture, texture_entry &entry, int dropLevel);
+	void account(texture_entry &entry, int dropLevel);
+	static int residentLevel(const texture_entry &entry);
+	static unsigned long long chainBytes(const texture_entry &entry, int dropLevel);
+
+	std::map<GLuint, texture_entry> entries;
+	texture_loader load;
+	std::vector<unsigned char> readback;	// levels kept by shrink(), reused
+	unsigned long long frame;
+	texture_stats stat;
+};
+
+#endif // TEXTURE_MANAGER_H
@@ -0,0 +1,46 @@
+#include "transform_stage.h"
+#include "cpu_profiler.h"
+#include <glm/gtc/matrix_inverse.hpp>
+#if (GLM_ARCH & GLM_ARCH_SSE2)
+	#include <glm/gtx/simd_mat4.hpp>
+#endif
+
+void transform_objects(const glm::mat4 &vp, object_block *blocks, size_t count)
+{
+	PROFILE_SCOPE("transform objects");
+#if (GLM_ARCH & GLM_ARCH_SSE2)
+	glm::simdMat4 viewProj(vp);
+	for (size_t i=0;i<count;i++) {
+		glm::simdMat4 model(blocks[i].model);
+		blocks[i].mvp = glm::mat4_cast(viewProj * model);
+
+		// Columns of the inverse-transpose are the rows of the inverse.
+		// glm declares the SIMD inverse in glm but defines it in glm::detail
+		glm::mat4 inv = glm::mat4_cast(glm::detail::inverse(model));
+		for (int c=0;c<3;c++)
+			blocks[i].normalMatrix[c] = glm::vec4(inv[0][c], inv[1][c], inv[2][c], 0.0f);
+	}
+#else
+	for (size_t i=0;i<count;i++) {
+		blocks[i].mvp = vp * blocks[i].model;
+		glm::mat3 normal = glm::inverseTranspose(glm::mat3(blocks[i].model));
+		for (int c=0;c<3;c++)
+			blocks[i].normalMatrix[c] = glm::vec4(normal[c], 0.0f);
+	}
+#endif
+}
+
+void transform_instances(instance_data *instances, size_t count)
+{
+	PROFILE_SCOPE("transform instances");
+#if (GLM_ARCH & GLM_ARCH_SSE2)
+	for (size_t i=0;i<count;i++) {
+		glm::mat4 inv = glm::mat4_cast(glm::detail::inverse(glm::simdMat4(instances[i].model)));
+		for (int c=0;c<3;c++)
+			instances[i].normal[c] = glm::vec3(inv[0][c], inv[1][c], inv[2][c]);
+	}
+#else
+	for (size_t i=0;i<count;i++)
+		instances[i].normal = glm::inverseTranspose(glm::mat3(instances[i].model));
+#endif
+}
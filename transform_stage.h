@@ -0,0 +1,17 @@
+#ifndef TRANSFORM_STAGE_H
+#define TRANSFORM_STAGE_H
+
+#include <cstddef>
+#include <glm/glm.hpp>
+#include "uniform_blocks.h"
+#include "instance_buffer.h"
+
+// Per-object transform stage on the CPU.
+// From `model` of every block it fills `mvp` and `normalMatrix`
+// (upper-left 3x3 of transpose(inverse(model))), so the vertex shaders don't need
+// to invert a matrix for every vertex. SSE2 is used through glm's SIMD types when available.
+void transform_objects(const glm::mat4 &vp, object_block *blocks, size_t count);
+// Same for instances, only `normal` is filled, the view-projection is applied in the shader
+void transform_instances(instance_data *instances, size_t count);
+
+#endif // TRANSFORM_STAGE_H
@@ -0,0 +1,61 @@
+#include "uniform_blocks.h"
+#include <cstring>
+
+// Round `size` up to a multiple of `align`
+static size_t alignUp(size_t size, size_t align)
+{
+	return (size + align - 1) / align * align;
+}
+
+void UniformBlocks::init()
+{
+	GLint align = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+	offsetAlignment = align;
+	alignment = alignUp(sizeof(object_block), align);
+	frameData = frame_block();
+}
+
+void UniformBlocks::bindProgram(unsigned int program)
+{
+	GLuint index = glGetUniformBlockIndex(program, "FrameData");
+	if (index != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, index, FRAME_BLOCK_BINDING);
+	index = glGetUniformBlockIndex(program, "ObjectData");
+	if (index != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, index, OBJECT_BLOCK_BINDING);
+}
+
+object_block &UniformBlocks::object(size_t index)
+{
+	if (index >= objects.size())
+		objects.resize(index+1);
+	return objects[index];
+}
+
+size_t UniformBlocks::uploadSize(size_t count) const
+{
+	return sizeof(frame_block) + offsetAlignment + count*alignment + offsetAlignment;
+}
+
+void UniformBlocks::upload(size_t count, StreamBuffer &stream)
+{
+	size_t offset;
+	unsigned char *dst = (unsigned char*)stream.allocate(sizeof(frame_block), offsetAlignment, offset);
+	if (dst == nullptr)
+		return;
+	memcpy(dst, &frameData, sizeof(frameData));
+	buffer = stream.buffer();
+	glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, buffer, offset, sizeof(frame_block));
+
+	dst = (unsigned char*)stream.allocate(count*alignment, offsetAlignment, objectBase);
+	if (dst == nullptr)
+		return;
+	for (size_t i=0;i<count && i<objects.size();i++)
+		memcpy(dst+i*alignment, &objects[i], sizeof(object_block));
+}
+
+void UniformBlocks::bindObject(size_t index)
+{
+	glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_BLOCK_BINDING, buffer, objectBase+index*alignment, sizeof(object_block));
+}
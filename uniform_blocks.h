@@ -0,0 +1,66 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "stream_buffer.h"
+
+// Binding points of the uniform blocks, same in every lighting shader
+#define FRAME_BLOCK_BINDING 0
+#define OBJECT_BLOCK_BINDING 1
+#define MAX_LIGHTS 4
+
+// std140 layout of "FrameData" in the shaders
+struct frame_block{
+	glm::mat4 vp;						// view-projection of the camera
+	glm::vec4 viewPos;					// camera position, w unused
+	GLint lightCount;
+	GLint pad[3];
+	glm::vec4 lightPos[MAX_LIGHTS];		// point lights, w unused
+};
+
+// std140 layout of "ObjectData" in the shaders
+struct object_block{
+	glm::mat4 model;
+	glm::mat4 mvp;						// vp * model
+	glm::vec4 normalMatrix[3];			// mat3 columns are padded to vec4 in std140
+	glm::vec4 ambientLight;				// w unused
+};
+
+// All uniform block data of a frame is written into the stream buffer:
+// the frame block first, then one object block per object, each aligned to
+// GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT. Every draw only selects its object block
+// with glBindBufferRange.
+class UniformBlocks{
+public:
+	UniformBlocks(): buffer(0), offsetAlignment(256), alignment(256), objectBase(0) {}
+
+	void init();
+
+	// Connect the blocks of `program` to the binding points, once after linking
+	static void bindProgram(unsigned int program);
+
+	frame_block &frame() { return frameData; }
+	// Object block `index`, it grows the storage if it is needed
+	object_block &object(size_t index);
+	// Make room for `count` object blocks, so object() doesn't allocate below that
+	void reserve(size_t count) { objects.reserve(count); }
+	object_block *objectArray() { return objects.data(); }
+	// Stream buffer bytes needed by upload(count)
+	size_t uploadSize(size_t count) const;
+	// Write the frame and `count` objects into the stream buffer
+	void upload(size_t count, StreamBuffer &stream);
+	// Select the object block of the next draw
+	void bindObject(size_t index);
+
+private:
+	GLuint buffer;			// stream buffer of this frame
+	size_t offsetAlignment;	// GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	size_t alignment;		// offsetAlignment rounded up to the block size
+	size_t objectBase;		// offset of the first object block in buffer
+	frame_block frameData;
+	std::vector<object_block> objects;
+};
+
+#endif // UNIFORM_BLOCKS_H
@@ -0,0 +1,127 @@
+#include "uniform_table.h"
+#include <glm/gtc/type_ptr.hpp>
+#include <cstdio>
+#include <cstring>
+
+unsigned int UniformTable::uploads = 0;
+unsigned int UniformTable::skipped = 0;
+
+void UniformTable::reflect(unsigned int program)
+{
+	this->program = program;
+	entries.clear();
+	if (program == 0)
+		return;
+
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	std::vector<char> name(maxLength+1);
+	for (GLint i=0;i<count;i++) {
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(program, i, name.size(), nullptr, &size, &type, name.data());
+
+		// Uniforms inside a uniform block have no location
+		GLint location = glGetUniformLocation(program, name.data());
+		if (location == -1)
+			continue;
+		uniform_entry entry;
+		entry.name = name.data();
+		entry.location = location;
+		entry.type = type;
+		entry.valid = false;
+		entries.push_back(entry);
+	}
+}
+
+int UniformTable::find(const char *name, GLenum type) const
+{
+	for (size_t i=0;i<entries.size();i++) {
+		if (entries[i].name != name)
+			continue;
+		bool sampler = (type == GL_INT && entries[i].type >= GL_SAMPLER_1D && entries[i].type <= GL_SAMPLER_2D_SHADOW);
+		if (entries[i].type != type && !sampler) {
+			fprintf(stderr, "Uniform %s has a different type\n", name);
+			return -1;
+		}
+		return i;
+	}
+	return -1;
+}
+
+// Compare with the shadow copy and update it, return true if it should be uploaded
+bool UniformTable::changed(int slot, const float *value, int count)
+{
+	uniform_entry &entry = entries[slot];
+	if (entry.valid && memcmp(entry.shadow, value, sizeof(float)*count) == 0) {
+		skipped++;
+		return false;
+	}
+	memcpy(entry.shadow, value, sizeof(float)*count);
+	entry.valid = true;
+	uploads++;
+	return true;
+}
+
+void UniformTable::set(uniform_handle<int> handle, int value)
+{
+	// The shadow copy only compares bytes
+	if (handle.slot < 0 || !changed(handle.slot, (const float*)&value, 1))
+		return;
+	if (GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects)
+		glProgramUniform1i(program, entries[handle.slot].location, value);
+	else
+		glUniform1i(entries[handle.slot].location, value);
+}
+
+void UniformTable::set(uniform_handle<float> handle, float value)
+{
+	if (handle.slot < 0 || !changed(handle.slot, &value, 1))
+		return;
+	if (GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects)
+		glProgramUniform1f(program, entries[handle.slot].location, value);
+	else
+		glUniform1f(entries[handle.slot].location, value);
+}
+
+void UniformTable::set(uniform_handle<glm::vec2> handle, const glm::vec2 &value)
+{
+	if (handle.slot < 0 || !changed(handle.slot, glm::value_ptr(value), 2))
+		return;
+	if (GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects)
+		glProgramUniform2fv(program, entries[handle.slot].location, 1, glm::value_ptr(value));
+	else
+		glUniform2fv(entries[handle.slot].location, 1, glm::value_ptr(value));
+}
+
+void UniformTable::set(uniform_handle<glm::vec3> handle, const glm::vec3 &value)
+{
+	if (handle.slot < 0 || !changed(handle.slot, glm::value_ptr(value), 3))
+		return;
+	if (GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects)
+		glProgramUniform3fv(program, entries[handle.slot].location, 1, glm::value_ptr(value));
+	else
+		glUniform3fv(entries[handle.slot].location, 1, glm::value_ptr(value));
+}
+
+// mat3 and mat4 of glm are column major, same as opengl, so we don't transpose them
+void UniformTable::set(uniform_handle<glm::mat3> handle, const glm::mat3 &value)
+{
+	if (handle.slot < 0 || !changed(handle.slot, glm::value_ptr(value), 9))
+		return;
+	if (GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects)
+		glProgramUniformMatrix3fv(program, entries[handle.slot].location, 1, GL_FALSE, glm::value_ptr(value));
+	else
+		glUniformMatrix3fv(entries[handle.slot].location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void UniformTable::set(uniform_handle<glm::mat4> handle, const glm::mat4 &value)
+{
+	if (handle.slot < 0 || !changed(handle.slot, glm::value_ptr(value), 16))
+		return;
+	if (GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects)
+		glProgramUniformMatrix4fv(program, entries[handle.slot].location, 1, GL_FALSE, glm::value_ptr(value));
+	else
+		glUniformMatrix4fv(entries[handle.slot].location, 1, GL_FALSE, glm::value_ptr(value));
+}
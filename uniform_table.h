@@ -0,0 +1,71 @@
+#ifndef UNIFORM_TABLE_H
+#define UNIFORM_TABLE_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+
+// Typed handle into a UniformTable, slot is -1 if the uniform is not active
+template <typename T>
+struct uniform_handle{
+	int slot;
+	uniform_handle(): slot(-1) {}
+};
+
+// Uniforms of one program, reflected once after linking with glGetActiveUniform.
+// Setters use the cached location and never look it up or bind the program:
+// with GL 4.1 (or ARB_separate_shader_objects) glProgramUniform is used,
+// otherwise the program must already be in use.
+// A shadow copy of every value is kept, so uploading an unchanged value is skipped.
+class UniformTable{
+public:
+	UniformTable(): program(0) {}
+
+	void reflect(unsigned int program);
+	unsigned int owner() const { return program; }
+
+	// Look up a uniform once at setup time. Invalid if it does not exist or the type is different
+	template <typename T> uniform_handle<T> handle(const char *name) const
+	{
+		uniform_handle<T> result;
+		result.slot = find(name, glType((const T*)nullptr));
+		return result;
+	}
+
+	// Samplers are set with an int handle to their texture unit
+	void set(uniform_handle<int> handle, int value);
+	void set(uniform_handle<float> handle, float value);
+	void set(uniform_handle<glm::vec2> handle, const glm::vec2 &value);
+	void set(uniform_handle<glm::vec3> handle, const glm::vec3 &value);
+	void set(uniform_handle<glm::mat3> handle, const glm::mat3 &value);
+	void set(uniform_handle<glm::mat4> handle, const glm::mat4 &value);
+
+	// Counters of all tables, reset them every frame
+	static unsigned int uploads;	// glUniform calls issued
+	static unsigned int skipped;	// calls dropped because the value did not change
+
+private:
+	struct uniform_entry{
+		std::string name;
+		GLint location;
+		GLenum type;
+		float shadow[16];	// last uploaded value
+		bool valid;			// false until the first upload
+	};
+
+	int find(const char *name, GLenum type) const;
+	bool changed(int slot, const float *value, int count);
+
+	static GLenum glType(const int*) { return GL_INT; }
+	static GLenum glType(const float*) { return GL_FLOAT; }
+	static GLenum glType(const glm::vec2*) { return GL_FLOAT_VEC2; }
+	static GLenum glType(const glm::vec3*) { return GL_FLOAT_VEC3; }
+	static GLenum glType(const glm::mat3*) { return GL_FLOAT_MAT3; }
+	static GLenum glType(const glm::mat4*) { return GL_FLOAT_MAT4; }
+
+	unsigned int program;
+	std::vector<uniform_entry> entries;
+};
+
+#endif // UNIFORM_TABLE_H